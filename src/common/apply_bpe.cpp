@@ -0,0 +1,29 @@
+#include <iostream>
+#include <string>
+
+#include "common/processor/bpe.h"
+#include "common/utils.h"
+
+// Segments the lines of stdin with the BPE codes of the bpe option, one line
+// of output per line of input. Used by tests/Makefile to compare the
+// segmentations of different BPE implementations.
+int main(int argc, char* argv[]) {
+  if(argc != 2) {
+    std::cerr << "Usage: " << argv[0] << " codes.bpe < input > output" << std::endl;
+    return 1;
+  }
+
+  try {
+    BPE bpe(argv[1]);
+    std::string line;
+    while(std::getline(std::cin, line)) {
+      std::cout << Join(bpe.Segment(line)) << "\n";
+    }
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
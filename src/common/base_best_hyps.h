@@ -4,8 +4,13 @@
 #include <vector>
 
 #include "common/types.h"
+#include "common/hypothesis.h"
 #include "scorer.h"
 
 
-using BestHypsType = std::function<void(Beam&, const Beam&, const size_t,
-                    const std::vector<ScorerPtr>&, const Words&, bool)>;
+// Selects the next beam for every sentence of a batch. The rows of the
+// scorers' probability matrices are the concatenated previous beams. New
+// hypotheses are allocated from the arena of their sentence.
+using BestHypsType = std::function<void(Beams&, const Beams&, const std::vector<size_t>&,
+                    const std::vector<ScorerPtr>&, const Words&, bool,
+                    const std::vector<HypothesisArena*>&)>;
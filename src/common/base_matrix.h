@@ -6,7 +6,7 @@
 #include "common/types.h"
 
 class Hypothesis;
-typedef std::shared_ptr<Hypothesis> HypothesisPtr;
+typedef Hypothesis* HypothesisPtr;
 typedef std::vector<HypothesisPtr> Beam;
 
 class Scorer;
@@ -99,6 +99,17 @@ void Validate(const YAML::Node& config) {
 
   for(auto&& pair: config["scorers"])
     UTIL_THROW_IF2(!(config["weights"][pair.first.as<std::string>()]), "Scorer has no weight: " << pair.first.as<std::string>());
+
+  UTIL_THROW_IF2(config["max-length-factor"].as<float>() <= 0,
+                 "max-length-factor must be positive");
+
+  // the bound of early-exit holds only if no step improves a score
+  if(config["early-exit"].as<bool>()) {
+    for(auto&& pair: config["weights"])
+      UTIL_THROW_IF2(pair.second.as<float>() <= 0,
+                     "early-exit needs positive weights, " << pair.first.as<std::string>()
+                     << " has " << pair.second.as<float>());
+  }
 }
 
 void OutputRec(const YAML::Node node, YAML::Emitter& out) {
@@ -200,6 +211,17 @@ void Config::AddOptions(size_t argc, char** argv) {
      "Use WIPO specific n-best-list format and non-buffering single-threading")
     ("return-alignment", po::value<bool>()->zero_tokens()->default_value(false),
      "If true, return alignment.")
+    ("server", po::value<bool>()->zero_tokens()->default_value(false),
+     "Run as a translation server, one sentence per line over a socket")
+    ("port,p", po::value<size_t>()->default_value(8080),
+     "TCP port of the translation server")
+    ("bind-address", po::value<std::string>()->default_value("127.0.0.1"),
+     "Address the TCP server listens on. The server has no authentication, "
+     "so only use others than the loopback address in trusted networks")
+    ("socket", po::value<std::string>(),
+     "Listen on this Unix socket instead of a TCP port")
+    ("max-batch-wait", po::value<size_t>()->default_value(0),
+     "Server: microseconds a request may wait for others to fill a mini-batch")
     ("version,v", po::value<bool>()->zero_tokens()->default_value(false),
      "Print version.")
     ("help,h", po::value<bool>()->zero_tokens()->default_value(false),
@@ -218,6 +240,35 @@ void Config::AddOptions(size_t argc, char** argv) {
      "Allow generation of UNK")
     ("n-best", po::value<bool>()->zero_tokens()->default_value(false),
      "Output n-best list with n = beam-size")
+    ("early-exit", po::value<bool>()->zero_tokens()->default_value(false),
+     "Stop decoding a sentence when no hypothesis can beat the best finished one. "
+     "Assumes that every scorer returns log-probabilities and has a positive weight")
+    ("max-length-factor", po::value<float>()->default_value(3.0),
+     "Maximum translation length as a multiple of the source length")
+    ("max-length", po::value<size_t>()->default_value(0),
+     "Maximum translation length in words, 0 for no limit")
+    ("mini-batch", po::value<size_t>()->default_value(1),
+     "Number of sentences decoded together in one batch (CPU only)")
+    ("preprocess-threads", po::value<size_t>()->default_value(0),
+     "Number of threads that preprocess input lines (BPE, vocabulary lookup) "
+     "ahead of decoding, 0 to preprocess in the decoding threads")
+    ("parallel-encoder", po::value<bool>()->zero_tokens()->default_value(false),
+     "Run the two directions of the CPU encoder in parallel threads")
+    ("int16-kernel", po::value<std::string>()->default_value("auto"),
+     "SIMD kernel of quantized CPU scorers: sse, avx2, avx512bw or auto "
+     "for the widest one the CPU supports")
+    ("encoder-cache-size", po::value<size_t>()->default_value(0),
+     "Number of encoded source sentences kept per CPU model for repeated "
+     "input, 0 disables the cache")
+    ("bpe-cache-size", po::value<size_t>()->default_value(100000),
+     "Number of BPE segmentations of words kept per BPE model")
+    ("translation-cache-size", po::value<size_t>()->default_value(0),
+     "Number of translations of repeated input lines kept, 0 disables the cache")
+    ("translation-cache-file", po::value<std::string>(),
+     "Load the translation cache from this file at start and save it at exit")
+    ("maxi-batch", po::value<size_t>()->default_value(0),
+     "Number of input lines read ahead and sorted by source length "
+     "before they are split into mini-batches, 0 disables sorting")
   ;
 
   po::options_description configuration("Configuration meta options");
@@ -263,13 +314,30 @@ void Config::AddOptions(size_t argc, char** argv) {
 
   // Simple overwrites
   SET_OPTION("n-best", bool);
+  SET_OPTION("early-exit", bool);
+  SET_OPTION("max-length-factor", float);
+  SET_OPTION("max-length", size_t);
   SET_OPTION("normalize", bool);
   SET_OPTION("wipo", bool);
   SET_OPTION("return-alignment", bool);
+  SET_OPTION("server", bool);
+  SET_OPTION("port", size_t);
+  SET_OPTION("bind-address", std::string);
+  SET_OPTION_NONDEFAULT("socket", std::string);
+  SET_OPTION("max-batch-wait", size_t);
   SET_OPTION("softmax-filter", std::vector<std::string>);
   SET_OPTION("allow-unk", bool);
   SET_OPTION("no-debpe", bool);
   SET_OPTION("beam-size", size_t);
+  SET_OPTION("mini-batch", size_t);
+  SET_OPTION("preprocess-threads", size_t);
+  SET_OPTION("parallel-encoder", bool);
+  SET_OPTION("int16-kernel", std::string);
+  SET_OPTION("encoder-cache-size", size_t);
+  SET_OPTION("bpe-cache-size", size_t);
+  SET_OPTION("translation-cache-size", size_t);
+  SET_OPTION_NONDEFAULT("translation-cache-file", std::string);
+  SET_OPTION("maxi-batch", size_t);
   SET_OPTION("cpu-threads", size_t);
 #ifdef CUDA
   SET_OPTION("gpu-threads", size_t);
@@ -314,6 +382,30 @@ void Config::AddOptions(size_t argc, char** argv) {
   }
 }
 
+namespace {
+
+// Options whose value cannot change a translation, which Config::Hash leaves
+// out. Any option not listed here is hashed, so new options invalidate
+// persisted results until they are known to be output-neutral.
+const std::set<std::string> OutputNeutralOptions = {
+  "config", "input-file", "devices", "gpu-threads", "cpu-threads",
+  "server", "port", "bind-address", "socket", "max-batch-wait",
+  "mini-batch", "maxi-batch", "preprocess-threads", "parallel-encoder",
+  "encoder-cache-size", "bpe-cache-size", "translation-cache-size",
+  "translation-cache-file", "show-weights", "dump-config", "version", "help"
+};
+
+}
+
+size_t Config::Hash() {
+  YAML::Node options = YAML::Clone(config_);
+  for(auto& key : OutputNeutralOptions)
+    options.remove(key);
+  YAML::Emitter out;
+  OutputRec(options, out);
+  return std::hash<std::string>()(out.c_str());
+}
+
 void Config::LogOptions() {
   std::stringstream ss;
   YAML::Emitter out;
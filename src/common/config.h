@@ -34,4 +34,9 @@ class Config {
     }
     
     void LogOptions();
+
+    // A hash of all options that can change translations, to recognize
+    // results of the same configuration. Every option is hashed unless it is
+    // listed as output-neutral in config.cpp.
+    size_t Hash();
 };
@@ -2,36 +2,13 @@
 #include <iostream>
 #include <string>
 #include <boost/timer/timer.hpp>
-#include <boost/thread/tss.hpp>
 
 #include "common/god.h"
 #include "common/logging.h"
-#include "common/search.h"
 #include "common/threadpool.h"
-#include "common/printer.h"
-#include "common/sentence.h"
 #include "common/exception.h"
-
-History TranslationTask(const std::string& in, size_t taskCounter) {
-#ifdef __APPLE__
-  static boost::thread_specific_ptr<Search> s_search;
-  Search *search = s_search.get();
-
-  if(search == NULL) {
-    LOG(info) << "Created Search for thread " << std::this_thread::get_id();
-    search = new Search(taskCounter);
-    s_search.reset(search);
-  }
-#else
-  thread_local std::unique_ptr<Search> search;
-  if(!search) {
-    LOG(info) << "Created Search for thread " << std::this_thread::get_id();
-    search.reset(new Search(taskCounter));
-  }
-#endif
-
-  return search->Decode(Sentence(taskCounter, in));
-}
+#include "common/server.h"
+#include "common/translator.h"
 
 int main(int argc, char* argv[]) {
   God::Init(argc, argv);
@@ -45,43 +22,27 @@ int main(int argc, char* argv[]) {
   size_t cpuThreads = God::Get<size_t>("cpu-threads");
   LOG(info) << "Setting CPU thread count to " << cpuThreads;
 
-  size_t totalThreads = cpuThreads;
 #ifdef CUDA
   size_t gpuThreads = God::Get<size_t>("gpu-threads");
-  auto devices = God::Get<std::vector<size_t>>("devices");
   LOG(info) << "Setting GPU thread count to " << gpuThreads;
-  totalThreads += gpuThreads * devices.size();
 #endif
 
+  size_t totalThreads = God::GetTotalThreads();
   LOG(info) << "Total number of threads: " << totalThreads;
   UTIL_THROW_IF2(totalThreads == 0, "Total number of threads is 0");
 
-  if (God::Get<bool>("wipo")) {
+  if (God::Get<bool>("server")) {
+    ThreadPool pool(totalThreads);
+    Server(pool, totalThreads).Run();
+  } else if (God::Get<bool>("wipo")) {
     LOG(info) << "Reading input";
     while (std::getline(God::GetInputStream(), in)) {
-      History result = TranslationTask(in, taskCounter);
-      Printer(result, taskCounter++, std::cout);
+      std::cout << TranslateAndPrint(MakeSentences({in}, taskCounter++))[0];
     }
   } else {
     ThreadPool pool(totalThreads);
     LOG(info) << "Reading input";
-
-    std::vector<std::future<History>> results;
-
-    while(std::getline(God::GetInputStream(), in)) {
-
-      results.emplace_back(
-        pool.enqueue(
-          [=]{ return TranslationTask(in, taskCounter); }
-        )
-      );
-
-      taskCounter++;
-    }
-
-    size_t lineCounter = 0;
-    for (auto&& result : results)
-      Printer(result.get(), lineCounter++, std::cout);
+    TranslateStream(God::GetInputStream(), std::cout, pool, totalThreads);
   }
   LOG(info) << "Total time: " << timer.format();
   God::CleanUp();
@@ -7,7 +7,9 @@
 #include <memory>
 #include <set>
 #include <cmath>
+#include <cstdint>
 #include <algorithm>
+#include <numeric>
 
 #include "common/god.h"
 #include "common/vocab.h"
@@ -84,31 +86,36 @@ std::vector<Words> Filter::ParseAlignmentFile(const Vocab& srcVocab,
   return vecMapper;
 }
 
-// Words Filter::GetFilteredVocab(const Words& srcWords, const size_t maxVocabSize) const {
-  // std::set<Word> filtered;
+Words Filter::GetFilteredVocab(const Words& srcWords, const size_t maxVocabSize) const {
+  // One bit per target word, kept by every thread for its next sentence.
+  // Reading it in order sorts the translations and clears it again.
+  thread_local std::vector<uint64_t> bitmap;
+  const size_t numFirstWords = std::min(numFirstWords_, maxVocabSize);
+  bitmap.resize(std::max(bitmap.size(), (maxVocabSize + 63) / 64), 0);
 
-  // for(size_t i = 0; i < std::min(numFirstWords_, maxVocabSize); ++i) {
-    // filtered.insert(i);
-  // }
-
-  // for (const auto& srcWord : srcWords) {
-    // size_t licz = 0;
-    // for (const auto& trgWord : mapper_[srcWord]) {
-      // if (trgWord < maxVocabSize) {
-        // ++licz;
-      // }
-    // }
-    // for (const auto& trgWord : mapper_[srcWord]) {
-      // if (trgWord < maxVocabSize) {
-        // filtered.insert(trgWord);
-      // }
-    // }
-  // }
-
-  // Words output(filtered.begin(), filtered.end());
+  size_t count = numFirstWords;
+  for (const auto& srcWord : srcWords) {
+    for (const auto& trgWord : mapper_[srcWord]) {
+      if (trgWord >= numFirstWords && trgWord < maxVocabSize) {
+        uint64_t bit = uint64_t(1) << (trgWord % 64);
+        uint64_t& block = bitmap[trgWord / 64];
+        count += !(block & bit);
+        block |= bit;
+      }
+    }
+  }
 
-  // return output;
-// }
+  Words output(count);
+  std::iota(output.begin(), output.begin() + numFirstWords, 0);
+  auto out = output.begin() + numFirstWords;
+  for (size_t i = numFirstWords / 64; out != output.end(); ++i) {
+    for (uint64_t block = bitmap[i]; block; block &= block - 1) {
+      *out++ = i * 64 + __builtin_ctzll(block);
+    }
+    bitmap[i] = 0;
+  }
+  return output;
+}
 
 size_t Filter::GetNumFirstWords() const {
   return numFirstWords_;
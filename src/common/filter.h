@@ -2,8 +2,7 @@
 
 #include <string>
 #include <memory>
-#include <unordered_set>
-#include <set>
+#include <vector>
 
 #include "common/types.h"
 
@@ -19,26 +18,9 @@ class Filter {
            const size_t numFirstWords=10000,
            const size_t maxNumTranslation=1000);
 
-    template<class T>
-    Words GetFilteredVocab(const T& srcWords, const size_t maxVocabSize) const {
-      std::set<Word> filtered;
-
-      for(size_t i = 0; i < std::min(numFirstWords_, maxVocabSize); ++i) {
-        filtered.insert(i);
-      }
-
-      for (const auto& srcWord : srcWords) {
-        for (const auto& trgWord : mapper_[srcWord]) {
-          if (trgWord < maxVocabSize) {
-            filtered.insert(trgWord);
-          }
-        }
-      }
-
-      Words output(filtered.begin(), filtered.end());
-
-      return output;
-    }
+    // The first numFirstWords ids and the translations of srcWords that are
+    // below maxVocabSize, in increasing order.
+    Words GetFilteredVocab(const Words& srcWords, const size_t maxVocabSize) const;
 
     size_t GetNumFirstWords() const;
 
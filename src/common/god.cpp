@@ -10,6 +10,8 @@
 #include "common/threadpool.h"
 #include "common/file_stream.h"
 #include "common/filter.h"
+#include "common/translation_cache.h"
+#include "common/search.h"
 #include "common/processor/bpe.h"
 #include "common/utils.h"
 
@@ -91,14 +93,15 @@ void God::LoadPrePostProcessing() {
       for(auto bpePath : Get<std::vector<std::string>>("bpe")) {
         LOG(info) << "using bpe: " << bpePath;
         preprocessors_.push_back(std::vector<PreprocessorPtr>());
-        preprocessors_[i++].emplace_back(new BPE(bpePath));
+        preprocessors_[i++].emplace_back(new BPE(bpePath, "@@", Get<size_t>("bpe-cache-size")));
       }
     }
     else {
       LOG(info) << "using bpe: " << Get<std::string>("bpe");
         preprocessors_.push_back(std::vector<PreprocessorPtr>());
       if (Get<std::string>("bpe") != "") {
-        preprocessors_[0].emplace_back(new BPE(Get<std::string>("bpe")));
+        preprocessors_[0].emplace_back(new BPE(Get<std::string>("bpe"), "@@",
+                                               Get<size_t>("bpe-cache-size")));
       }
     }
   }
@@ -109,6 +112,22 @@ void God::LoadPrePostProcessing() {
   }
 }
 
+void God::LoadTranslationCache() {
+  translationCache_.reset();
+  size_t cacheSize = Get<size_t>("translation-cache-size");
+  if (cacheSize == 0) {
+    return;
+  }
+  if (Get<bool>("n-best")) {
+    LOG(info) << "No translation cache for n-best lists";
+    return;
+  }
+
+  std::string path = Has("translation-cache-file")
+                   ? Get<std::string>("translation-cache-file") : "";
+  translationCache_.reset(new TranslationCache(cacheSize, path, config_.Hash()));
+}
+
 God& God::NonStaticInit(int argc, char** argv) {
   info_ = spdlog::stderr_logger_mt("info");
   info_->set_pattern("[%c] (%L) %v");
@@ -151,15 +170,16 @@ God& God::NonStaticInit(int argc, char** argv) {
   }
 
   LoadPrePostProcessing();
+  LoadTranslationCache();
 
   return *this;
 }
 
-Vocab& God::GetSourceVocab(size_t i) {
+const Vocab& God::GetSourceVocab(size_t i) {
   return *(Summon().sourceVocabs_[i]);
 }
 
-Vocab& God::GetTargetVocab() {
+const Vocab& God::GetTargetVocab() {
   return *Summon().targetVocab_;
 }
 
@@ -167,6 +187,10 @@ Filter& God::GetFilter() {
   return *(Summon().filter_);
 }
 
+TranslationCache* God::GetTranslationCache() {
+  return Summon().translationCache_.get();
+}
+
 std::istream& God::GetInputStream() {
   return *Summon().inputStream_;
 }
@@ -195,6 +219,16 @@ BestHypsType God::GetBestHyps(size_t threadId) {
   }
 }
 
+size_t God::GetTotalThreads() {
+  size_t totalThreads = God::Get<size_t>("cpu-threads");
+#ifdef CUDA
+  size_t gpuThreads = God::Get<size_t>("gpu-threads");
+  auto devices = God::Get<std::vector<size_t>>("devices");
+  totalThreads += gpuThreads * devices.size();
+#endif
+  return totalThreads;
+}
+
 std::vector<std::string> God::GetScorerNames() {
   std::vector<std::string> scorerNames;
   for(auto&& name : Summon().cpuLoaders_ | boost::adaptors::map_keys)
@@ -234,6 +268,16 @@ std::vector<std::string> God::Postprocess(const std::vector<std::string>& input)
 }
 // clean up cuda vectors before cuda context goes out of scope
 void God::CleanUp() {
+  Search::LogStatistics();
+  for (auto& processors : Summon().preprocessors_) {
+    for (auto& processor : processors) {
+      processor->LogStatistics();
+    }
+  }
+  if (Summon().translationCache_) {
+    Summon().translationCache_->LogStatistics();
+    Summon().translationCache_.reset();
+  }
   for (auto& loader : Summon().cpuLoaders_ | boost::adaptors::map_values) {
      loader.reset(nullptr);
   }
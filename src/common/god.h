@@ -14,6 +14,7 @@ class Weights;
 class Vocab;
 class Filter;
 class InputFileStream;
+class TranslationCache;
 
 class God {
   public:
@@ -39,15 +40,20 @@ class God {
       return Summon().config_.Get(key);
     }
 
-    static Vocab& GetSourceVocab(size_t i = 0);
-    static Vocab& GetTargetVocab();
+    static const Vocab& GetSourceVocab(size_t i = 0);
+    static const Vocab& GetTargetVocab();
 
     static std::istream& GetInputStream();
 
     static Filter& GetFilter();
 
+    // nullptr unless translation-cache-size is set.
+    static TranslationCache* GetTranslationCache();
+
     static BestHypsType GetBestHyps(size_t threadId);
 
+    static size_t GetTotalThreads();
+
     static std::vector<ScorerPtr> GetScorers(size_t);
     static std::vector<std::string> GetScorerNames();
     static std::map<std::string, float>& GetScorerWeights();
@@ -65,6 +71,7 @@ class God {
     void LoadScorers();
     void LoadFiltering();
     void LoadPrePostProcessing();
+    void LoadTranslationCache();
 
     static God instance_;
     Config config_;
@@ -85,4 +92,5 @@ class God {
     std::shared_ptr<spdlog::logger> progress_;
 
     std::unique_ptr<InputFileStream> inputStream_;
+    std::unique_ptr<TranslationCache> translationCache_;
 };
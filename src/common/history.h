@@ -1,5 +1,8 @@
 #pragma once
 
+#include <algorithm>
+#include <functional>
+#include <limits>
 #include <queue>
 
 #include "god.h"
@@ -20,15 +23,24 @@ class History {
 
   public:
     History()
-    :normalize_(God::Get<bool>("normalize"))
+    :normalize_(God::Get<bool>("normalize")),
+     arena_(new HypothesisArena())
     {}
 
+    // Owns the hypotheses of this sentence; copies of a History share it.
+    HypothesisArena& GetArena() {
+      return *arena_;
+    }
+
     void Add(const Beam& beam, bool last = false) {
-      if (beam.back()->GetPrevHyp() != nullptr) {
+      if (beam.back()->HasPrev()) {
         for (size_t j = 0; j < beam.size(); ++j)
           if(beam[j]->GetWord() == EOS || last) {
             float cost = normalize_ ? beam[j]->GetCost() / history_.size() : beam[j]->GetCost();
             topHyps_.push({ history_.size(), j, cost });
+            finishedCosts_.insert(std::upper_bound(finishedCosts_.begin(), finishedCosts_.end(),
+                                                   cost, std::greater<float>()),
+                                  cost);
           }
       }
       history_.push_back(beam);
@@ -50,9 +62,9 @@ class History {
 
         Words targetWords;
         HypothesisPtr bestHyp = history_[start][j];
-        while(bestHyp->GetPrevHyp() != nullptr) {
+        while(bestHyp->HasPrev()) {
           targetWords.push_back(bestHyp->GetWord());
-          bestHyp = bestHyp->GetPrevHyp();
+          bestHyp = arena_->GetPrevHyp(*bestHyp);
         }
 
         std::reverse(targetWords.begin(), targetWords.end());
@@ -61,10 +73,35 @@ class History {
       return nbest;
     }
 
+    // The cost of the n-th best finished hypothesis as NBest ranks it,
+    // normalized if that is enabled; the lowest float if there are fewer.
+    float FinishedCost(size_t n) const {
+      if (n == 0 || finishedCosts_.size() < n)
+        return std::numeric_limits<float>::lowest();
+      return finishedCosts_[n - 1];
+    }
+
     Result Top() const {
       return NBest(1)[0];
     }
 
+    HypothesisPtr GetPrevHyp(const Hypothesis& hyp) const {
+      return arena_->GetPrevHyp(hyp);
+    }
+
+    // The cost of every scorer, empty without n-best lists.
+    std::vector<float> GetCostBreakdown(const Hypothesis& hyp) const {
+      const float* costs = arena_->GetCostBreakdown(hyp);
+      return std::vector<float>(costs, costs + arena_->GetBreakdownSize());
+    }
+
+    // The attention of scorer when hyp chose its word, empty without
+    // return-alignment.
+    SoftAlignment GetAlignment(const Hypothesis& hyp, size_t scorer) const {
+      const float* alignment = arena_->GetAlignment(hyp, scorer);
+      return SoftAlignment(alignment, alignment + arena_->GetAlignmentLength());
+    }
+
   std::vector<std::string> sourceWordList;
   std::string sourceText;
   Sentence sentence;
@@ -72,5 +109,9 @@ class History {
   private:
     std::vector<Beam> history_;
     std::priority_queue<HypothesisCoord> topHyps_;
+    std::vector<float> finishedCosts_;
     bool normalize_;
+    HypothesisArenaPtr arena_;
 };
+
+typedef std::vector<History> Histories;
@@ -1,39 +1,50 @@
 #pragma once
+#include <cstdint>
 #include <memory>
+#include <utility>
 #include "common/types.h"
 #include "common/soft_alignment.h"
 
 class Hypothesis;
 
-typedef std::shared_ptr<Hypothesis> HypothesisPtr;
+// Hypotheses are owned by the HypothesisArena of their sentence.
+typedef Hypothesis* HypothesisPtr;
 
+// A node of the search graph. It refers to its predecessor by its number
+// in the arena and holds no other data, so it needs no allocation of its
+// own; cost breakdowns and alignments are kept by the arena.
 class Hypothesis {
   public:
-    Hypothesis()
-     : prevHyp_(nullptr),
+    static const uint32_t NoPrev = UINT32_MAX;
+
+    Hypothesis(uint32_t id)
+     : id_(id),
+       prev_(NoPrev),
        prevIndex_(0),
        word_(0),
        cost_(0.0)
     {}
 
-    Hypothesis(const HypothesisPtr prevHyp, size_t word, size_t prevIndex, float cost)
-      : prevHyp_(prevHyp),
+    Hypothesis(uint32_t id, uint32_t prev, size_t word, size_t prevIndex, float cost)
+      : id_(id),
+        prev_(prev),
         prevIndex_(prevIndex),
         word_(word),
         cost_(cost)
     {}
 
-    Hypothesis(const HypothesisPtr prevHyp, size_t word, size_t prevIndex, float cost,
-               std::vector<SoftAlignmentPtr> alignment)
-      : prevHyp_(prevHyp),
-        prevIndex_(prevIndex),
-        word_(word),
-        cost_(cost),
-        alignments_(alignment)
-    {}
+    // The number of this hypothesis in its arena.
+    uint32_t GetId() const {
+      return id_;
+    }
 
-    const HypothesisPtr GetPrevHyp() const {
-      return prevHyp_;
+    // The number of the predecessor, NoPrev for the start hypothesis.
+    uint32_t GetPrev() const {
+      return prev_;
+    }
+
+    bool HasPrev() const {
+      return prev_ != NoPrev;
     }
 
     size_t GetWord() const {
@@ -48,28 +59,108 @@ class Hypothesis {
       return cost_;
     }
 
-    std::vector<float>& GetCostBreakdown() {
-      return costBreakdown_;
+  private:
+    uint32_t id_;
+    uint32_t prev_;
+    uint32_t prevIndex_;
+    uint32_t word_;
+    float cost_;
+};
+
+// Allocates the hypotheses of one sentence in blocks and frees them all at
+// once with the arena, so beam search neither calls the allocator nor
+// counts references per hypothesis. Cost breakdowns (n-best lists) and
+// alignments are stored in flat arrays indexed by hypothesis number; they
+// are only allocated once BestHyps sets their size.
+class HypothesisArena {
+  public:
+    HypothesisArena()
+      : size_(0), breakdownSize_(0), alignmentLength_(0), alignmentScorers_(0)
+    {}
+
+    HypothesisArena(const HypothesisArena&) = delete;
+    HypothesisArena& operator=(const HypothesisArena&) = delete;
+
+    // The start hypothesis.
+    HypothesisPtr New() {
+      return Add(Hypothesis(size_));
+    }
+
+    HypothesisPtr New(HypothesisPtr prevHyp, size_t word, size_t prevIndex, float cost) {
+      return Add(Hypothesis(size_, prevHyp->GetId(), word, prevIndex, cost));
     }
 
-    SoftAlignmentPtr GetAlignment(size_t i) {
-      return alignments_[i];
+    HypothesisPtr Get(uint32_t id) {
+      return &blocks_[id / BlockSize][id % BlockSize];
     }
 
-    std::vector<SoftAlignmentPtr>& GetAlignments() {
-      return alignments_;
+    // The predecessor of hyp, nullptr for the start hypothesis.
+    HypothesisPtr GetPrevHyp(const Hypothesis& hyp) {
+      return hyp.HasPrev() ? Get(hyp.GetPrev()) : nullptr;
+    }
+
+    // Costs of every scorer, see BestHyps. Zero until set.
+    void SetBreakdownSize(size_t scorers) {
+      breakdownSize_ = scorers;
+    }
+
+    size_t GetBreakdownSize() const {
+      return breakdownSize_;
+    }
+
+    // Valid until the next hypothesis is allocated.
+    float* GetCostBreakdown(const Hypothesis& hyp) {
+      if (breakdowns_.size() < size_ * breakdownSize_)
+        breakdowns_.resize(size_ * breakdownSize_, 0.0f);
+      return breakdowns_.data() + hyp.GetId() * breakdownSize_;
+    }
+
+    // The attention of every scorer over length source words.
+    void SetAlignmentSize(size_t scorers, size_t length) {
+      alignmentScorers_ = scorers;
+      alignmentLength_ = length;
+    }
+
+    size_t GetAlignmentLength() const {
+      return alignmentLength_;
+    }
+
+    // Valid until the next hypothesis is allocated.
+    float* GetAlignment(const Hypothesis& hyp, size_t scorer) {
+      size_t stride = alignmentScorers_ * alignmentLength_;
+      if (alignments_.size() < size_ * stride)
+        alignments_.resize(size_ * stride, 0.0f);
+      return alignments_.data() + hyp.GetId() * stride + scorer * alignmentLength_;
     }
 
   private:
-    const HypothesisPtr prevHyp_;
-    const size_t prevIndex_;
-    const size_t word_;
-    const float cost_;
-    std::vector<SoftAlignmentPtr> alignments_;
+    HypothesisPtr Add(const Hypothesis& hyp) {
+      // blocks never grow beyond their capacity, so hypotheses never move
+      if (blocks_.empty() || blocks_.back().size() == BlockSize) {
+        blocks_.emplace_back();
+        blocks_.back().reserve(BlockSize);
+      }
+      blocks_.back().push_back(hyp);
+      ++size_;
+      return &blocks_.back().back();
+    }
 
-    std::vector<float> costBreakdown_;
+    static const size_t BlockSize = 256;
+
+    std::vector<std::vector<Hypothesis>> blocks_;
+    size_t size_;
+
+    size_t breakdownSize_;
+    std::vector<float> breakdowns_;
+
+    size_t alignmentLength_;
+    size_t alignmentScorers_;
+    std::vector<float> alignments_;
 };
 
+typedef std::shared_ptr<HypothesisArena> HypothesisArenaPtr;
+
 typedef std::vector<HypothesisPtr> Beam;
+typedef std::vector<Beam> Beams;
 typedef std::pair<Words, HypothesisPtr> Result;
 typedef std::vector<Result> NBestList;
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <functional>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+// A map of at most capacity entries that evicts the least recently used
+// one. All methods lock, so one cache can be shared by several threads;
+// values should be cheap to copy, e.g. shared pointers.
+template <class Key, class Value, class Hash = std::hash<Key>>
+class LRUCache {
+  public:
+    explicit LRUCache(size_t capacity)
+    : capacity_(capacity), hits_(0), misses_(0)
+    {}
+
+    // Copies the value of key into value and marks it as most recently used.
+    bool Get(const Key& key, Value& value) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      auto it = index_.find(key);
+      if(it == index_.end()) {
+        ++misses_;
+        return false;
+      }
+      ++hits_;
+      items_.splice(items_.begin(), items_, it->second);
+      value = it->second->second;
+      return true;
+    }
+
+    void Put(const Key& key, const Value& value) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if(capacity_ == 0) {
+        return;
+      }
+      auto it = index_.find(key);
+      if(it != index_.end()) {
+        it->second->second = value;
+        items_.splice(items_.begin(), items_, it->second);
+        return;
+      }
+      if(items_.size() == capacity_) {
+        index_.erase(items_.back().first);
+        items_.pop_back();
+      }
+      items_.emplace_front(key, value);
+      index_.emplace(key, items_.begin());
+    }
+
+    // Calls f(key, value) for every entry, least recently used first, so
+    // that putting them into another cache in this order keeps the order.
+    template <class F>
+    void ForEach(F f) const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for(auto it = items_.rbegin(); it != items_.rend(); ++it) {
+        f(it->first, it->second);
+      }
+    }
+
+    size_t Size() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return items_.size();
+    }
+
+    size_t Capacity() const {
+      return capacity_;
+    }
+
+    size_t Hits() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return hits_;
+    }
+
+    size_t Misses() const {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return misses_;
+    }
+
+  private:
+    typedef std::list<std::pair<Key, Value>> Items;
+
+    const size_t capacity_;
+    size_t hits_;
+    size_t misses_;
+
+    // most recently used first
+    Items items_;
+    std::unordered_map<Key, typename Items::iterator, Hash> index_;
+    mutable std::mutex mutex_;
+};
@@ -0,0 +1,49 @@
+#include "common/output_collector.h"
+
+OutputCollector::OutputCollector(std::ostream& out, size_t maxPending)
+  : out_(out), maxPending_(maxPending), nextLine_(0)
+{}
+
+void OutputCollector::Write(size_t lineNo, const std::string& output) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  pending_.emplace(lineNo, output);
+
+  bool printed = false;
+  while (!pending_.empty() && pending_.begin()->first == nextLine_) {
+    out_ << pending_.begin()->second << std::flush;
+    pending_.erase(pending_.begin());
+    ++nextLine_;
+    printed = true;
+  }
+
+  if (printed) {
+    printed_.notify_all();
+  }
+}
+
+void OutputCollector::WaitForRoom(size_t lineNo) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (lineNo >= maxPending_) {
+    Wait(lock, lineNo - maxPending_ + 1);
+  }
+}
+
+void OutputCollector::WaitUntil(size_t lineNo) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  Wait(lock, lineNo);
+}
+
+void OutputCollector::Abort(std::exception_ptr error) {
+  std::unique_lock<std::mutex> lock(mutex_);
+  if (!error_) {
+    error_ = error;
+  }
+  printed_.notify_all();
+}
+
+void OutputCollector::Wait(std::unique_lock<std::mutex>& lock, size_t lineNo) {
+  printed_.wait(lock, [&]{ return error_ || nextLine_ >= lineNo; });
+  if (error_) {
+    std::rethrow_exception(error_);
+  }
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <condition_variable>
+#include <exception>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Prints translations in input order as soon as all earlier lines are done.
+// Workers hand over finished lines in any order; the reader calls
+// WaitForRoom before queueing more input, so at most maxPending lines are
+// in flight or waiting in the reorder buffer at any time.
+class OutputCollector {
+  public:
+    OutputCollector(std::ostream& out, size_t maxPending);
+
+    void Write(size_t lineNo, const std::string& output);
+
+    // Blocks until line lineNo may be queued without exceeding maxPending.
+    void WaitForRoom(size_t lineNo);
+
+    // Blocks until all lines before lineNo have been printed.
+    void WaitUntil(size_t lineNo);
+
+    // Called by a worker that failed, rethrown to the waiting reader.
+    void Abort(std::exception_ptr error);
+
+  private:
+    void Wait(std::unique_lock<std::mutex>& lock, size_t lineNo);
+
+    std::ostream& out_;
+    const size_t maxPending_;
+
+    std::map<size_t, std::string> pending_;
+    size_t nextLine_;
+    std::exception_ptr error_;
+
+    std::mutex mutex_;
+    std::condition_variable printed_;
+};
@@ -25,12 +25,13 @@ void Printer(const History& history, size_t lineNo, OStream& out) {
       const Result& result = nbl[i];
       const Words &words = result.first;
       const HypothesisPtr &hypo = result.second;
+      std::vector<float> costBreakdown = history.GetCostBreakdown(*hypo);
 
       if(God::Get<bool>("wipo"))
         out << "OUT: ";
       out << lineNo << " ||| " << Join(God::Postprocess(God::GetTargetVocab()(words))) << " |||";
-      for(size_t j = 0; j < hypo->GetCostBreakdown().size(); ++j) {
-        out << " " << scorerNames[j] << "= " << hypo->GetCostBreakdown()[j];
+      for(size_t j = 0; j < costBreakdown.size(); ++j) {
+        out << " " << scorerNames[j] << "= " << costBreakdown[j];
       }
       if(God::Get<bool>("normalize")) {
         out << " ||| " << hypo->GetCost() / words.size() << std::endl;
@@ -54,9 +55,9 @@ void Printer(const History& history, size_t lineNo, OStream& out) {
     if(God::Get<bool>("return-alignment") || God::Has("unknown-word-placeholder")) {
       //extract attention matrix (used for alignment)
       auto last = history.Top().second;  
-      while (last->GetPrevHyp().get() != nullptr) {
-        aligns.push_back(*(last->GetAlignment(0)));
-        last = last->GetPrevHyp();
+      while (last->HasPrev()) {
+        aligns.push_back(history.GetAlignment(*last, 0));
+        last = history.GetPrevHyp(*last);
       }
       std::reverse(aligns.begin(), aligns.end());
     }
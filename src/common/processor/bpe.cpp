@@ -1,11 +1,12 @@
 #include "common/processor/bpe.h"
 
-#include <mutex>
+#include <queue>
 #include <sstream>
 #include <iostream>
 
 #include "utf8/utf8.h"
 #include "common/utils.h"
+#include "common/logging.h"
 
 
 std::vector<std::vector<std::string>> BPE::Preprocess(const std::vector<std::string> input) {
@@ -29,21 +30,95 @@ std::vector<std::string> BPE::Postprocess(const std::vector<std::string> input)
 }
 
 BPE::BPE()
-  : sep_("@@") {}
+  : endOfWord_(Intern("</w>")), merges_(16), mergeCount_(0), sep_("@@") {
+  InitCache(DefaultCacheSize);
+}
 
-BPE::BPE(std::ifstream&& file,  const std::string sep)
-  : sep_(sep) {
+BPE::BPE(std::ifstream&& file,  const std::string sep, size_t cacheSize)
+  : endOfWord_(Intern("</w>")), merges_(16), mergeCount_(0), sep_(sep) {
+  InitCache(cacheSize);
   std::string inputLine;
-  size_t index = 0;
+  uint32_t index = 0;
   while (std::getline(file, inputLine)) {
     std::vector<std::string> code;
     Split(inputLine, code);
-    bpeCodes_[make_pair(code[0], code[1])] = index++;
+    AddMerge(Intern(code[0]), Intern(code[1]), index++, Intern(code[0] + code[1]));
+  }
+}
+
+BPE::SymbolId BPE::Intern(const std::string& symbol) {
+  return symbols_.emplace(symbol, symbols_.size() + 1).first->second;
+}
+
+BPE::SymbolId BPE::Find(const std::string& symbol) const {
+  auto it = symbols_.find(symbol);
+  return it == symbols_.end() ? 0 : it->second;
+}
+
+void BPE::AddMerge(SymbolId left, SymbolId right, uint32_t rank, SymbolId result) {
+  if (2 * (mergeCount_ + 1) > merges_.size()) {
+    std::vector<Merge> old(2 * merges_.size());
+    std::swap(old, merges_);
+    mergeCount_ = 0;
+    for (auto& merge : old) {
+      if (merge.key) {
+        AddMerge(merge.key >> 32, merge.key & 0xffffffff, merge.rank, merge.result);
+      }
+    }
+  }
+
+  uint64_t key = Key(left, right);
+  size_t mask = merges_.size() - 1;
+  size_t i = Slot(key) & mask;
+  while (merges_[i].key && merges_[i].key != key) {
+    i = (i + 1) & mask;
+  }
+  // a repeated code keeps its last rank, like a map assignment would
+  if (!merges_[i].key) {
+    ++mergeCount_;
+  }
+  merges_[i] = { key, rank, result };
+}
+
+const BPE::Merge* BPE::FindMerge(SymbolId left, SymbolId right) const {
+  if (!left || !right) {
+    return nullptr;
+  }
+  uint64_t key = Key(left, right);
+  size_t mask = merges_.size() - 1;
+  size_t i = Slot(key) & mask;
+  while (merges_[i].key) {
+    if (merges_[i].key == key) {
+      return &merges_[i];
+    }
+    i = (i + 1) & mask;
   }
+  return nullptr;
 }
 
-BPE::BPE(const std::string& path, const std::string sep)
-  : BPE(std::ifstream(path), sep) {}
+BPE::BPE(const std::string& path, const std::string sep, size_t cacheSize)
+  : BPE(std::ifstream(path), sep, cacheSize) {}
+
+void BPE::InitCache(size_t cacheSize) {
+  for (size_t i = 0; i < CacheShards; ++i) {
+    cache_.emplace_back(new Cache((cacheSize + CacheShards - 1) / CacheShards));
+  }
+}
+
+BPE::Cache& BPE::GetShard(const std::string& word) {
+  return *cache_[std::hash<std::string>()(word) % CacheShards];
+}
+
+void BPE::LogStatistics() const {
+  size_t hits = 0, misses = 0, size = 0;
+  for (auto& shard : cache_) {
+    hits += shard->Hits();
+    misses += shard->Misses();
+    size += shard->Size();
+  }
+  LOG(info) << "BPE cache: " << hits << " hits, " << misses << " misses, "
+            << size << " words";
+}
 
 std::vector<std::string> BPE::Segment(const std::string& sentence) {
   std::vector<std::string> words, tokens;
@@ -80,108 +155,109 @@ void BPE::PrintSegment(const std::string& sentence) {
   }
 }
 
-std::set<BPE::BPEPair> BPE::GetPairs(const std::vector<std::string>& word) {
-  std::set<BPE::BPEPair> pairSet;
-  for (size_t i = 1; i < word.size(); ++i) {
-    pairSet.emplace(word[i-1], word[i]);
+std::vector<std::string> BPE::Encode(const std::string& word) {
+  Cache& shard = GetShard(word);
+  std::shared_ptr<const std::vector<std::string>> cached;
+  if (shard.Get(word, cached)) {
+    return *cached;
   }
-  return pairSet;
-}
-
-const BPE::BPEPair* BPE::FindBestBigram(const std::set<BPEPair>& pairs) {
-  size_t minDist = bpeCodes_.size();
-  auto best = bpeCodes_.begin();
 
-  for (const auto& pair : pairs) {
-    auto it = bpeCodes_.find(pair);
-    if (it == bpeCodes_.end()) {
-      continue;
+  // The letters of the word and the end of word marker as a linked list,
+  // each with the bytes of the word it covers. A merge joins a symbol with
+  // its successor.
+  struct Symbol {
+    SymbolId id;
+    int prev;
+    int next;
+    size_t begin;
+    size_t end;
+  };
+  std::vector<Symbol> symbols;
+  const char* b = word.c_str();
+  const char* e = b + word.size();
+  while (b != e) {
+    const char* letter = b;
+    utf8::next(b, e);
+    size_t begin = letter - word.c_str();
+    int index = symbols.size();
+    symbols.push_back({ Find(std::string(letter, b)), index - 1, index + 1,
+                        begin, begin + (b - letter) });
+  }
+  int index = symbols.size();
+  symbols.push_back({ endOfWord_, index - 1, -1, word.size(), word.size() });
+
+  // Candidate merges of neighbours, lowest rank and then leftmost first.
+  // Entries become stale when one of their symbols takes part in another
+  // merge first; they are recognized by the symbol ids.
+  struct Candidate {
+    uint32_t rank;
+    int left;
+    SymbolId leftId;
+    SymbolId rightId;
+
+    bool operator<(const Candidate& other) const {
+      return rank > other.rank || (rank == other.rank && left > other.left);
     }
-    if (it->second < minDist) {
-      minDist = it->second;
-      best = it;
+  };
+  std::priority_queue<Candidate> candidates;
+  auto propose = [&](int left) {
+    if (left < 0 || symbols[left].next < 0) {
+      return;
     }
+    const Symbol& right = symbols[symbols[left].next];
+    if (const Merge* merge = FindMerge(symbols[left].id, right.id)) {
+      candidates.push({ merge->rank, left, symbols[left].id, right.id });
+    }
+  };
+  for (int i = 0; i + 1 < int(symbols.size()); ++i) {
+    propose(i);
   }
-  if (minDist == bpeCodes_.size()) {
-    return nullptr;
-  }
-  else {
-  return &(best->first);
-  }
-}
-
-std::vector<std::string>& BPE::Encode(const std::string& word) {
-  if (IsCached(word)) {
-    return cache_[word];
-  }
-
-  std::vector<std::string> vWord = SplitWordIntoLetters(word);
-  vWord.push_back("</w>");
 
-  auto pairs = GetPairs(vWord);
-
-  while (true) {
-    const BPEPair* bigram = FindBestBigram(pairs);
-    if (bigram == nullptr) {
-      break;
+  while (!candidates.empty()) {
+    Candidate candidate = candidates.top();
+    candidates.pop();
+    Symbol& left = symbols[candidate.left];
+    if (left.id != candidate.leftId || left.next < 0
+        || symbols[left.next].id != candidate.rightId) {
+      continue;
     }
 
-    std::vector<std::string> newWord;
-
-    auto it = vWord.begin();
-    while (it != vWord.end()) {
-      auto jt = std::find(it, vWord.end(), bigram->first);
-      for (auto i = it; i != jt; ++i) {
-        newWord.push_back(*i);
-      }
-
-      if (jt == vWord.end()) {
-        break;
-      }
-      it = jt;
-
-      if (*it == bigram->first && (it+1) != vWord.end() && *(it+1) == bigram->second) {
-        newWord.emplace_back(bigram->first + bigram->second);
-        it += 2;
-      } else {
-        newWord.push_back(*it);
-        it += 1;
-      }
-    }
-    std::swap(vWord, newWord);
-    if (newWord.size() == 1) {
-      break;
-    } else {
-      pairs = GetPairs(vWord);
+    Symbol& right = symbols[left.next];
+    left.id = FindMerge(left.id, right.id)->result;
+    left.end = right.end;
+    left.next = right.next;
+    if (right.next >= 0) {
+      symbols[right.next].prev = candidate.left;
     }
-  }
+    right.id = 0;
 
-  if (vWord.back() == "</w>") {
-    vWord.pop_back();
+    propose(left.prev);
+    propose(candidate.left);
   }
 
-  if (EndsWith(vWord.back(), "</w>")) {
-    vWord.back().resize(vWord.back().size() - 4);
+  // A trailing end of word marker disappears, also when it is merged.
+  std::vector<std::string> vWord;
+  for (int i = 0; i >= 0; i = symbols[i].next) {
+    if (symbols[i].begin < word.size()) {
+      vWord.emplace_back(word, symbols[i].begin, symbols[i].end - symbols[i].begin);
+    }
+  }
+  if (vWord.empty()) {
+    vWord.emplace_back();
   }
 
   for (size_t i = 0;  i < vWord.size() - 1; ++i) {
-    vWord[i] = vWord[i] + sep_;
+    vWord[i] += sep_;
   }
 
-  std::mutex mtx;
-  mtx.lock();
-  cache_[word] = vWord;
-  mtx.unlock();
-
-  return cache_[word];
+  shard.Put(word, std::make_shared<const std::vector<std::string>>(vWord));
+  return vWord;
 }
 
 std::vector<std::vector<std::string>> BPE::Encode(const std::vector<std::string>& words) {
   std::vector<std::vector<std::string>> result;
   for (const auto& word : words) {
-    auto& encoded = Encode(word);
-    //result.insert(result.end(), encoded.begin(), encoded.end());
-    result.push_back(encoded);
+    result.push_back(Encode(word));
   }
   // std::cerr << "BPE: ";
   // for (auto& code: result) std::cerr << code << " " ;
@@ -190,26 +266,6 @@ std::vector<std::vector<std::string>> BPE::Encode(const std::vector<std::string>
 }
 
 
-bool BPE::IsCached(const std::string& word) const {
-  return cache_.find(word) != cache_.end();
-}
-
-std::vector<std::string> BPE::SplitWordIntoLetters(const std::string& word) const {
-  char* charWord = (char*)word.c_str();
-  auto b = charWord;
-  auto e = charWord + strlen(charWord);
-
-  std::vector<std::string> letters;
-  int prevBegin = 0;
-  while (b != e) {
-    int end = utf8::next(b, e);
-    std::vector<unsigned char> utf8result;
-    utf8::utf32to8(&end,&end + 1, std::back_inserter(utf8result));
-    letters.emplace_back(utf8result.begin(), utf8result.end());
-  }
-  return letters;
-}
-
 bool BPE::EndsWith(std::string const &fullString, std::string const suffix) const {
   if (fullString.length() >= suffix.length()) {
     return (0 == fullString.compare(fullString.length() - suffix.length(), suffix.length(), suffix));
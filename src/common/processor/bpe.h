@@ -3,69 +3,87 @@
 #include <vector>
 #include <string>
 #include <fstream>
-#include <set>
+#include <cstdint>
 #include <unordered_map>
 #include <iterator>
+#include <memory>
 
+#include "common/lru_cache.h"
 #include "common/processor/processor.h"
 
-template<class T>
-inline void hash_combine(std::size_t & seed, const T & v)
-{
-  std::hash<T> hasher;
-  seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-}
-
-namespace std
-{
-  template<typename S, typename T> struct hash<pair<S, T>>
-  {
-      inline size_t operator()(const pair<S, T> & v) const
-      {
-            size_t seed = 0;
-            ::hash_combine(seed, v.first);
-            ::hash_combine(seed, v.second);
-            return seed;
-          }
-    };
-}
-
 class BPE : public Processor {
-  using BPEPair = std::pair<std::string, std::string>;
-
   public:
     BPE();
-    BPE(std::ifstream&& file, const std::string sep = "@@");
+    BPE(std::ifstream&& file, const std::string sep = "@@",
+        size_t cacheSize = DefaultCacheSize);
 
-    BPE(const std::string& path, const std::string sep = "@@");
+    BPE(const std::string& path, const std::string sep = "@@",
+        size_t cacheSize = DefaultCacheSize);
 
     std::vector<std::string> Segment(const std::string& sentence);
 
     void PrintSegment(const std::string& sentence);
 
-    std::vector<std::string>& Encode(const std::string& word);
+    // Safe to call from several threads at once.
+    std::vector<std::string> Encode(const std::string& word);
 
     std::vector<std::vector<std::string>> Encode(const std::vector<std::string>& words);
 
     std::vector<std::vector<std::string>> Preprocess(const std::vector<std::string> input);
     std::vector<std::string> Postprocess(const std::vector<std::string> input);
 
+    void LogStatistics() const;
+
     virtual ~BPE() {}
+
+    static const size_t DefaultCacheSize = 100000;
   private:
-    std::set<BPEPair> GetPairs(const std::vector<std::string>& word);
+    // Codes are applied to interned symbols: every letter, part and result
+    // of a code has an id, 0 for none.
+    typedef uint32_t SymbolId;
+
+    struct Merge {
+      uint64_t key;   // the two symbols, see Key
+      uint32_t rank;  // line of the code, lower ones are applied first
+      SymbolId result;
+    };
+
+    static uint64_t Key(SymbolId left, SymbolId right) {
+      return (uint64_t(left) << 32) | right;
+    }
 
-    const BPEPair* FindBestBigram(const std::set<BPEPair>& pairs);
+    // std::hash is the identity for integers, which would put all pairs
+    // with the same right symbol into the same slot.
+    static size_t Slot(uint64_t key) {
+      key *= 0x9e3779b97f4a7c15ull;
+      return key ^ (key >> 32);
+    }
 
-    bool IsCached(const std::string& word) const;
+    SymbolId Intern(const std::string& symbol);
+    SymbolId Find(const std::string& symbol) const;
 
-    std::vector<std::string> SplitWordIntoLetters(const std::string& word) const;
+    void AddMerge(SymbolId left, SymbolId right, uint32_t rank, SymbolId result);
+    const Merge* FindMerge(SymbolId left, SymbolId right) const;
 
     bool EndsWith(const std::string& fullString, const std::string suffix) const;
 
-    std::unordered_map<BPEPair, size_t> bpeCodes_;
+    std::unordered_map<std::string, SymbolId> symbols_;
+    SymbolId endOfWord_;
+
+    // Open addressing with linear probing; key 0 marks empty slots, since
+    // symbol ids start at 1. Filled while loading, read-only afterwards.
+    std::vector<Merge> merges_;
+    size_t mergeCount_;
+
     const std::string sep_;
 
-    std::unordered_map<std::string, std::vector<std::string>> cache_;
+    // Segmented words, sharded by their hash so that threads rarely wait
+    // for the same lock.
+    typedef LRUCache<std::string, std::shared_ptr<const std::vector<std::string>>> Cache;
+    static const size_t CacheShards = 16;
+    std::vector<std::unique_ptr<Cache>> cache_;
 
+    void InitCache(size_t cacheSize);
+    Cache& GetShard(const std::string& word);
 
 };
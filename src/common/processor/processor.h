@@ -7,6 +7,10 @@
 class Preprocessor {
   public:
     virtual std::vector<std::vector<std::string>> Preprocess(const std::vector<std::string> input) = 0;
+
+    // Logs statistics of a run, e.g. of caches, at the end.
+    virtual void LogStatistics() const {}
+
     virtual ~Preprocessor() {}
 };
 
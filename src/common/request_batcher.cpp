@@ -0,0 +1,140 @@
+#include "common/request_batcher.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "common/logging.h"
+#include "common/exception.h"
+#include "common/translator.h"
+
+namespace {
+
+std::exception_ptr ShutdownError() {
+  return std::make_exception_ptr(std::runtime_error("Translation is shutting down"));
+}
+
+}
+
+RequestBatcher::Request::Request(const Sentence& sentence,
+                                 Callback done, ErrorCallback failed)
+  : sentence(sentence), done(done), failed(failed), arrival(Clock::now())
+{}
+
+RequestBatcher::RequestBatcher(ThreadPool& pool, size_t totalThreads,
+                               size_t maxBatch, size_t maxWait)
+  : pool_(pool), maxBatch_(maxBatch), maxWait_(maxWait),
+    idleThreads_(totalThreads), inFlight_(0), stop_(false)
+{
+  UTIL_THROW_IF2(maxBatch_ == 0, "mini-batch must be at least 1");
+  dispatcher_ = std::thread([this]{ Dispatch(); });
+}
+
+RequestBatcher::~RequestBatcher() {
+  Stop();
+  dispatcher_.join();
+
+  // the pool tasks of running batches still use this object
+  std::unique_lock<std::mutex> lock(mutex_);
+  changed_.wait(lock, [&]{ return inFlight_ == 0; });
+}
+
+std::future<void> RequestBatcher::Translate(const Sentence& sentence,
+                                            Callback done, ErrorCallback failed) {
+  std::unique_ptr<Request> request(new Request(sentence, done, failed));
+  std::future<void> finished = request->finished.get_future();
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!stop_) {
+      queue_.push_back(std::move(request));
+    }
+  }
+  if (request) {
+    Fail(*request, ShutdownError());
+  }
+  changed_.notify_all();
+  return finished;
+}
+
+void RequestBatcher::Stop() {
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stop_ = true;
+  }
+  changed_.notify_all();
+}
+
+void RequestBatcher::Dispatch() {
+  while (true) {
+    auto batch = std::make_shared<Batch>();
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      changed_.wait(lock, [&]{ return stop_ || (idleThreads_ > 0 && !queue_.empty()); });
+      if (!stop_) {
+        // Give the batch a chance to fill up, but never keep the oldest
+        // request waiting longer than maxWait.
+        changed_.wait_until(lock, queue_.front()->arrival + maxWait_,
+                            [&]{ return stop_ || queue_.size() >= maxBatch_; });
+      }
+      if (stop_) {
+        // nobody would decode the rest, so its callers must not wait for it
+        std::deque<std::unique_ptr<Request>> rest;
+        rest.swap(queue_);
+        lock.unlock();
+        for (auto& request : rest) {
+          Fail(*request, ShutdownError());
+        }
+        return;
+      }
+
+      size_t batchSize = std::min(maxBatch_, queue_.size());
+      for (size_t i = 0; i < batchSize; ++i) {
+        batch->push_back(std::move(queue_.front()));
+        queue_.pop_front();
+      }
+      --idleThreads_;
+      ++inFlight_;
+    }
+
+    pool_.enqueue([this, batch]{
+      Decode(*batch);
+      // notify under the lock: once it is released, the destructor may
+      // return and this object is gone
+      std::unique_lock<std::mutex> lock(mutex_);
+      ++idleThreads_;
+      --inFlight_;
+      changed_.notify_all();
+    });
+  }
+}
+
+void RequestBatcher::Decode(Batch& batch) {
+  Sentences sentences;
+  for (auto& request : batch) {
+    sentences.push_back(request->sentence);
+  }
+
+  Histories histories;
+  try {
+    histories = TranslationTask(sentences);
+  } catch(...) {
+    for (auto& request : batch) {
+      Fail(*request, std::current_exception());
+    }
+    return;
+  }
+
+  for (size_t i = 0; i < batch.size(); ++i) {
+    Request& request = *batch[i];
+    try {
+      request.done(histories[i]);
+      request.finished.set_value();
+    } catch(...) {
+      Fail(request, std::current_exception());
+    }
+  }
+}
+
+void RequestBatcher::Fail(Request& request, std::exception_ptr error) {
+  request.failed(error);
+  request.finished.set_exception(error);
+}
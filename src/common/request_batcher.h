@@ -0,0 +1,73 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common/history.h"
+#include "common/sentence.h"
+#include "common/threadpool.h"
+
+// Collects single sentences from any number of callers and decodes them
+// together. A batch is handed to the pool when a thread is free and either
+// max-batch sentences are waiting or the oldest one has waited maxWait
+// microseconds. While all threads are busy, requests keep piling up, so
+// batches grow with the load.
+class RequestBatcher {
+  public:
+    typedef std::function<void(const History&)> Callback;
+    typedef std::function<void(std::exception_ptr)> ErrorCallback;
+
+    RequestBatcher(ThreadPool& pool, size_t totalThreads,
+                   size_t maxBatch, size_t maxWait);
+    ~RequestBatcher();
+
+    // Queues a sentence. Either done or failed is called on a pool thread;
+    // the returned future is ready once that call has returned. Sentences
+    // that are still queued when the batcher is stopped or destroyed fail.
+    std::future<void> Translate(const Sentence& sentence,
+                                Callback done, ErrorCallback failed);
+
+    // Fails the queued sentences and all later ones. Batches that are
+    // being decoded still finish.
+    void Stop();
+
+  private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Request {
+      Request(const Sentence& sentence, Callback done, ErrorCallback failed);
+
+      Sentence sentence;
+      Callback done;
+      ErrorCallback failed;
+      std::promise<void> finished;
+      Clock::time_point arrival;
+    };
+    typedef std::vector<std::unique_ptr<Request>> Batch;
+
+    void Dispatch();
+    void Decode(Batch& batch);
+    static void Fail(Request& request, std::exception_ptr error);
+
+    ThreadPool& pool_;
+    const size_t maxBatch_;
+    const std::chrono::microseconds maxWait_;
+
+    std::deque<std::unique_ptr<Request>> queue_;
+    size_t idleThreads_;
+    // batches handed to the pool whose tasks have not finished yet
+    size_t inFlight_;
+    bool stop_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread dispatcher_;
+};
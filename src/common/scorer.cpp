@@ -1,7 +1,30 @@
 #include "scorer.h"
 
+#include "common/exception.h"
+
 Scorer::Scorer(const std::string& name,
 	   const YAML::Node& config, size_t tab)
 : name_(name), config_(config), tab_(tab)
 {
 }
+
+void Scorer::SetSource(const Sentences& sources) {
+  UTIL_THROW_IF2(sources.size() != 1,
+                 "Scorer " << name_ << " does not support batched decoding");
+  SetSource(sources[0]);
+}
+
+void Scorer::Filter(const std::vector<size_t>& ids,
+                    const std::vector<std::vector<size_t>>& excluded) {
+  UTIL_THROW_IF2(excluded.size() != 1,
+                 "Scorer " << name_ << " does not support batched decoding");
+  Filter(ids);
+}
+
+void Scorer::AssembleBeamState(const State& in,
+                               const Beams& beams,
+                               State& out) {
+  UTIL_THROW_IF2(beams.size() != 1,
+                 "Scorer " << name_ << " does not support batched decoding");
+  AssembleBeamState(in, beams[0], out);
+}
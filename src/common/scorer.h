@@ -47,8 +47,28 @@ class Scorer {
 
     virtual void SetSource(const Sentence& source) = 0;
 
+    // Batched decoding: scorers able to score several sentences at once
+    // override these and return true from SupportsBatching(). The default
+    // implementations only accept a batch of a single sentence.
+    virtual bool SupportsBatching() const {
+      return false;
+    }
+
+    virtual void SetSource(const Sentences& sources);
+
+    virtual void AssembleBeamState(const State& in,
+                                   const Beams& beams,
+                                   State& out);
+
     virtual void Filter(const std::vector<size_t>&) = 0;
 
+    // Filters the output layer of a batch by ids, the union of the
+    // shortlists of its sentences. excluded[s] are the columns of ids that
+    // are not in the shortlist of sentence s; they must not take part in
+    // its softmax, so a sentence is scored the same in any batch.
+    virtual void Filter(const std::vector<size_t>& ids,
+                        const std::vector<std::vector<size_t>>& excluded);
+
     virtual State* NewState() = 0;
 
     virtual size_t GetVocabSize() const = 0;
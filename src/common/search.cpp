@@ -1,5 +1,8 @@
 #include "common/search.h"
 
+#include <algorithm>
+#include <atomic>
+#include <iterator>
 #include <boost/timer/timer.hpp>
 
 #include "common/god.h"
@@ -10,35 +13,117 @@
 
 using namespace std;
 
+namespace {
+
+// Sentences whose translation was cut off at the maximum length.
+std::atomic<size_t> s_cutOff(0);
+
+}
+
 Search::Search(size_t threadId)
   : scorers_(God::GetScorers(threadId)),
     BestHyps_(God::GetBestHyps(threadId)) {
 }
 
 
-size_t Search::MakeFilter(const Words& srcWords, size_t vocabSize) {
-  filterIndices_ = God::GetFilter().GetFilteredVocab(srcWords, vocabSize);
-  for (size_t i = 0; i < scorers_.size(); i++) {
+size_t Search::MakeFilter(const Sentences& sentences, size_t vocabSize) {
+  const Filter& filter = God::GetFilter();
+  if (sentences.size() == 1) {
+    filterIndices_ = filter.GetFilteredVocab(sentences[0].GetWords(), vocabSize);
+    for (size_t i = 0; i < scorers_.size(); i++) {
       scorers_[i]->Filter(filterIndices_);
+    }
+    return filterIndices_.size();
+  }
+
+  // A batch shares one output layer, filtered by the union of the
+  // shortlists of its sentences; every sentence masks the columns of the
+  // others. Shortlists are sorted, so are the union and the masks.
+  std::vector<Words> shortlists;
+  filterIndices_.clear();
+  for (auto& sentence : sentences) {
+    shortlists.push_back(filter.GetFilteredVocab(sentence.GetWords(), vocabSize));
+    Words merged;
+    std::set_union(filterIndices_.begin(), filterIndices_.end(),
+                   shortlists.back().begin(), shortlists.back().end(),
+                   std::back_inserter(merged));
+    filterIndices_.swap(merged);
+  }
+
+  std::vector<std::vector<size_t>> excluded(sentences.size());
+  for (size_t s = 0; s < sentences.size(); ++s) {
+    auto own = shortlists[s].begin();
+    for (size_t column = 0; column < filterIndices_.size(); ++column) {
+      if (own != shortlists[s].end() && *own == filterIndices_[column]) {
+        ++own;
+      } else {
+        excluded[s].push_back(column);
+      }
+    }
+  }
+
+  for (size_t i = 0; i < scorers_.size(); i++) {
+    scorers_[i]->Filter(filterIndices_, excluded);
   }
   return filterIndices_.size();
 }
 
-History Search::Decode(const Sentence& sentence) {
-  boost::timer::cpu_timer timer;
+bool Search::SupportsBatching() const {
+  for (auto& scorer : scorers_) {
+    if (!scorer->SupportsBatching()) {
+      return false;
+    }
+  }
+  return true;
+}
 
-  size_t beamSize = God::Get<size_t>("beam-size");
-  bool normalize = God::Get<bool>("normalize");
+size_t Search::MaxLength(const Sentence& sentence) const {
+  size_t maxLength = sentence.GetMaxLength();
+  if (maxLength == 0) {
+    maxLength = sentence.GetWords().size() * God::Get<float>("max-length-factor");
+  }
+  size_t cap = God::Get<size_t>("max-length");
+  if (cap > 0) {
+    maxLength = std::min(maxLength, cap);
+  }
+  // at least one step, so every sentence ends with a finished hypothesis
+  return std::max<size_t>(maxLength, 1);
+}
+
+History Search::Decode(const Sentence& sentence) {
+  return Decode(Sentences(1, sentence))[0];
+}
 
-  // @TODO Future: in order to do batch sentence decoding
-  // it should be enough to keep track of hypotheses in
-  // separate History objects.
+Histories Search::Decode(const Sentences& sentences) {
+  if (sentences.size() > 1 && !SupportsBatching()) {
+    Histories histories;
+    for (auto& sentence : sentences) {
+      histories.push_back(Decode(sentence));
+    }
+    return histories;
+  }
 
-  History history;
-  history.sentence = sentence;
+  boost::timer::cpu_timer timer;
 
-  Beam prevHyps = { HypothesisPtr(new Hypothesis()) };
-  history.Add(prevHyps);
+  size_t beamSize = God::Get<size_t>("beam-size");
+  size_t batchSize = sentences.size();
+
+  // Every sentence keeps its own beam and History. The scorers see the
+  // concatenation of all beams, so their matrices have sum-of-beams rows.
+  Histories histories(batchSize);
+  Beams prevHyps(batchSize);
+  std::vector<size_t> beamSizes(batchSize, beamSize);
+  std::vector<size_t> maxLengths(batchSize);
+
+  std::vector<HypothesisArena*> arenas(batchSize);
+
+  for (size_t i = 0; i < batchSize; ++i) {
+    histories[i].sentence = sentences[i];
+    arenas[i] = &histories[i].GetArena();
+    prevHyps[i] = { arenas[i]->New() };
+    histories[i].Add(prevHyps[i]);
+    maxLengths[i] = MaxLength(sentences[i]);
+  }
 
   States states(scorers_.size());
   States nextStates(scorers_.size());
@@ -47,12 +132,12 @@ History Search::Decode(const Sentence& sentence) {
 
   bool filter = God::Get<std::vector<std::string>>("softmax-filter").size();
   if (filter) {
-    vocabSize = MakeFilter(sentence.GetWords(), vocabSize);
+    vocabSize = MakeFilter(sentences, vocabSize);
   }
 
   for (size_t i = 0; i < scorers_.size(); i++) {
     Scorer &scorer = *scorers_[i];
-    scorer.SetSource(sentence);
+    scorer.SetSource(sentences);
 
     states[i].reset(scorer.NewState());
     nextStates[i].reset(scorer.NewState());
@@ -60,33 +145,76 @@ History Search::Decode(const Sentence& sentence) {
     scorer.BeginSentenceState(*states[i]);
   }
 
-  const size_t maxLength = sentence.GetWords().size() * 3;
-  do {
+  bool returnAlignment = God::Get<bool>("return-alignment") || God::Has("unknown-word-placeholder");
+
+  // lines of this batch cut off at their maximum length
+  size_t cutOff = 0;
+
+  // With early-exit, a sentence is finished as soon as none of its
+  // hypotheses can end up better than the best finished one (or the
+  // beam-size-th best one for n-best lists). Costs only decrease, so a
+  // hypothesis can at best keep its cost; normalized, it can at best be
+  // spread over the maximal length. Single hypotheses are never dropped:
+  // the beam would shrink and let in candidates that a search without
+  // early-exit does not keep, which changes translations.
+  bool earlyExit = God::Get<bool>("early-exit");
+  bool normalize = God::Get<bool>("normalize");
+  size_t finishedRank = God::Get<bool>("n-best") ? beamSize : 1;
+
+  while (true) {
     for (size_t i = 0; i < scorers_.size(); i++) {
       Scorer &scorer = *scorers_[i];
       State &state = *states[i];
       State &nextState = *nextStates[i];
 
-      // prob.Resize(beamSize, vocabSize);
       scorer.Score(state, nextState);
     }
 
-    Beam hyps;
+    Beams hyps(batchSize);
+    BestHyps_(hyps, prevHyps, beamSizes, scorers_, filterIndices_,
+              returnAlignment, arenas);
+
+    Beams survivors(batchSize);
+    size_t active = 0;
+    for (size_t i = 0; i < batchSize; ++i) {
+      if (beamSizes[i] == 0) {
+        continue;
+      }
+
+      History& history = histories[i];
+      bool last = history.size() == maxLengths[i];
+      history.Add(hyps[i], last);
 
-    bool returnAlignment = God::Get<bool>("return-alignment") || God::Has("unknown-word-placeholder");
+      if (last && std::any_of(hyps[i].begin(), hyps[i].end(),
+                              [](HypothesisPtr h) { return h->GetWord() != EOS; })) {
+        ++cutOff;
+      }
 
-    BestHyps_(hyps, prevHyps, beamSize, scorers_, filterIndices_,
-                                     returnAlignment);
-    history.Add(hyps, history.size() == maxLength);
+      if (history.size() <= maxLengths[i]) {
+        for (auto h : hyps[i]) {
+          if (h->GetWord() != EOS) {
+            survivors[i].push_back(h);
+          }
+        }
+      }
 
-    Beam survivors;
-    for (auto h : hyps) {
-      if (h->GetWord() != EOS) {
-        survivors.push_back(h);
+      if (earlyExit) {
+        float bound = history.FinishedCost(finishedRank);
+        bool hopeless = std::none_of(survivors[i].begin(), survivors[i].end(),
+            [&](HypothesisPtr h) {
+              float best = normalize ? h->GetCost() / maxLengths[i]
+                                     : h->GetCost();
+              return best >= bound;
+            });
+        if (hopeless) {
+          survivors[i].clear();
+        }
       }
+      beamSizes[i] = survivors[i].size();
+      active += beamSizes[i];
     }
-    beamSize = survivors.size();
-    if (beamSize == 0) {
+
+    if (active == 0) {
       break;
     }
 
@@ -95,15 +223,28 @@ History Search::Decode(const Sentence& sentence) {
     }
 
     prevHyps.swap(survivors);
+  }
 
-  } while(history.size() <= maxLength);
-
-  LOG(progress) << "Line " << sentence.GetLine()
-                << ": Search took " << timer.format(3, "%ws");
+  s_cutOff += cutOff;
+  std::string cutOffNote = cutOff
+    ? ", " + std::to_string(cutOff) + " cut off at the maximum length" : "";
+
+  if (batchSize == 1) {
+    LOG(progress) << "Line " << sentences[0].GetLine()
+                  << ": Search took " << timer.format(3, "%ws") << cutOffNote;
+  } else {
+    LOG(progress) << "Batch of " << batchSize << " lines starting at line "
+                  << sentences[0].GetLine()
+                  << ": Search took " << timer.format(3, "%ws") << cutOffNote;
+  }
 
   for (auto scorer : scorers_) {
 	  scorer->CleanUpAfterSentence();
   }
 
-  return history;
+  return histories;
+}
+
+void Search::LogStatistics() {
+  LOG(info) << s_cutOff << " translations were cut off at the maximum length";
 }
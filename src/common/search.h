@@ -14,9 +14,16 @@ class Search {
   public:
     Search(size_t threadId);
     History Decode(const Sentence& sentence);
+    Histories Decode(const Sentences& sentences);
+
+    // Logs how many translations were cut off at the maximum length.
+    static void LogStatistics();
 
   private:
-    size_t MakeFilter(const Words& srcWords, size_t vocabSize);
+    size_t MakeFilter(const Sentences& sentences, size_t vocabSize);
+    bool SupportsBatching() const;
+    size_t MaxLength(const Sentence& sentence) const;
+
     std::vector<ScorerPtr> scorers_;
     Words filterIndices_;
     BestHypsType BestHyps_;
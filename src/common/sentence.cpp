@@ -3,21 +3,23 @@
 #include "utils.h"
 #include "common/vocab.h"
 
-Sentence::Sentence(){
+Sentence::Sentence()
+: maxLength_(0)
+{
 }
 
 Sentence::Sentence(size_t lineNo, const std::string& line)
-: lineNo_(lineNo), line_(line)
+: lineNo_(lineNo), line_(line), maxLength_(0)
 {
   std::vector<std::string> tabs;
   Split(line, tabs, "\t");
+  const Vocab& vocab = God::GetSourceVocab(0);
   size_t i = 0;
   for(auto&& tab : tabs) {
     std::vector<std::string> lineTokens;
     Trim(tab);
     Split(tab, lineTokens, " ");
     auto processed = God::Preprocess(i, lineTokens);
-    auto vocab = God::GetSourceVocab(0);
 
     if(God::Has("unknown-word-placeholder")){
 	bool thisWordIsUNK = false;
@@ -63,6 +65,10 @@ const Words& Sentence::GetWords(size_t index) const {
   return words_[index];
 }
 
+size_t Sentence::GetInputCount() const {
+  return words_.size();
+}
+
 size_t Sentence::GetLine() const {
   return lineNo_;
 }
@@ -71,5 +77,13 @@ std::string Sentence::GetText() const {
   return line_;
 }
 
+size_t Sentence::GetMaxLength() const {
+  return maxLength_;
+}
+
+void Sentence::SetMaxLength(size_t maxLength) {
+  maxLength_ = maxLength;
+}
+
 
 
@@ -11,11 +11,20 @@ class Sentence {
     Sentence(size_t lineNo, const std::string& line);
     
     const Words& GetWords(size_t index = 0) const;
+
+    // Number of tab-separated inputs, each with its own GetWords.
+    size_t GetInputCount() const;
     
     size_t GetLine() const;
 
     std::string GetText() const;
 
+    // Upper bound on the length of the translation that overrides the
+    // configured max-length-factor; 0 if there is none.
+    size_t GetMaxLength() const;
+
+    void SetMaxLength(size_t maxLength);
+
     std::set<size_t> unknownWordIndexes;
     std::map<size_t, std::string> unknownWords;
     std::vector<std::string> words;
@@ -24,5 +33,8 @@ class Sentence {
     std::vector<Words> words_;
     size_t lineNo_;
     std::string line_;
+    size_t maxLength_;
 };
 
+typedef std::vector<Sentence> Sentences;
+
@@ -0,0 +1,169 @@
+#include "common/server.h"
+
+#include <csignal>
+#include <functional>
+#include <memory>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <boost/asio.hpp>
+#include <boost/iostreams/device/file_descriptor.hpp>
+#include <boost/iostreams/stream.hpp>
+
+#include "common/god.h"
+#include "common/logging.h"
+#include "common/exception.h"
+#include "common/translator.h"
+
+Server::Server(ThreadPool& pool, size_t totalThreads)
+  : batcher_(pool, totalThreads,
+             God::Get<size_t>("mini-batch"),
+             God::Get<size_t>("max-batch-wait"))
+{}
+
+void Server::Run() {
+  // a client closing its connection early must not kill the server
+  std::signal(SIGPIPE, SIG_IGN);
+
+  boost::asio::io_service io;
+  if (God::Has("socket")) {
+    using boost::asio::local::stream_protocol;
+    std::string path = God::Get<std::string>("socket");
+    ::unlink(path.c_str());
+    stream_protocol::acceptor acceptor(io, stream_protocol::endpoint(path));
+    LOG(info) << "Listening on unix socket " << path;
+    Accept(acceptor, io);
+    ::unlink(path.c_str());
+  } else {
+    using boost::asio::ip::tcp;
+    size_t port = God::Get<size_t>("port");
+    std::string address = God::Get<std::string>("bind-address");
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address::from_string(address), port));
+    LOG(info) << "Listening on " << address << " port " << port;
+    Accept(acceptor, io);
+  }
+}
+
+template <class Socket>
+void Server::Accepted(Socket& socket) {
+  JoinFinished();
+
+  // Reading and writing happen on different threads, so each direction
+  // gets its own descriptor and stream.
+  int inFd = ::dup(socket.native_handle());
+  int outFd = ::dup(socket.native_handle());
+  UTIL_THROW_IF2(inFd < 0 || outFd < 0, "Cannot duplicate socket descriptor");
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  size_t id = ++lastId_;
+  open_.insert(inFd);
+  connections_.emplace(id, std::thread([this, id, inFd, outFd]{ Serve(id, inFd, outFd); }));
+}
+
+template <class Acceptor, class IoService>
+void Server::Accept(Acceptor& acceptor, IoService& io) {
+  // The first signal closes the acceptor and drains the connections on a
+  // thread of its own, so that a second one can still be received while
+  // the lines already read are translated.
+  std::thread drainer;
+  boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+  std::function<void(const boost::system::error_code&, int)> onSignal =
+    [&](const boost::system::error_code& error, int signal) {
+      if (error) {
+        return;
+      }
+      if (!drainer.joinable()) {
+        LOG(info) << "Received signal " << signal << ", shutting down";
+        acceptor.close();
+        drainer = std::thread([&]{
+          Drain();
+          io.post([&]{ signals.cancel(); });
+        });
+      } else {
+        LOG(info) << "Received signal " << signal << ", failing queued lines";
+        batcher_.Stop();
+      }
+      signals.async_wait(onSignal);
+    };
+  signals.async_wait(onSignal);
+
+  typedef typename Acceptor::protocol_type::socket Socket;
+  std::function<void()> next = [&]() {
+    auto socket = std::make_shared<Socket>(io);
+    acceptor.async_accept(*socket, [&, socket](const boost::system::error_code& error) {
+      // a connection accepted just before the acceptor was closed would
+      // escape Drain
+      if (error == boost::asio::error::operation_aborted || !acceptor.is_open()) {
+        return;
+      }
+      if (!error) {
+        Accepted(*socket);
+      } else {
+        LOG(info) << "Cannot accept connection: " << error.message();
+      }
+      next();
+    });
+  };
+
+  next();
+  io.run();
+  if (drainer.joinable()) {
+    drainer.join();
+  }
+}
+
+void Server::Serve(size_t id, int inFd, int outFd) {
+  namespace io = boost::iostreams;
+  LOG(info) << "Opened connection " << id;
+  {
+    io::stream<io::file_descriptor_source> in(inFd, io::close_handle);
+    io::stream<io::file_descriptor_sink> out(outFd, io::close_handle);
+
+    try {
+      TranslateStream(in, out, batcher_);
+    } catch(std::exception& e) {
+      LOG(info) << "Error on connection " << id << ": " << e.what();
+      // the client sees the translations of the earlier lines, then this
+      out << "ERROR: " << e.what() << std::endl;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    open_.erase(inFd);
+  }
+  LOG(info) << "Closed connection " << id;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  finished_.push_back(id);
+}
+
+void Server::JoinFinished() {
+  std::vector<std::thread> threads;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t id : finished_) {
+      threads.push_back(std::move(connections_[id]));
+      connections_.erase(id);
+    }
+    finished_.clear();
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+void Server::Drain() {
+  std::map<size_t, std::thread> connections;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    LOG(info) << "Finishing " << open_.size() << " open connections";
+    // reading then ends as if the client had sent everything, the lines
+    // already read are still translated and written back
+    for (int fd : open_) {
+      ::shutdown(fd, SHUT_RD);
+    }
+    connections.swap(connections_);
+    finished_.clear();
+  }
+  for (auto& it : connections) {
+    it.second.join();
+  }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "common/threadpool.h"
+#include "common/request_batcher.h"
+
+// Keeps God, the models and the thread-local searches alive and translates
+// lines sent over a TCP or Unix socket. Every connection is handled like
+// standard input: one sentence per line, with the output written back in
+// order, each line as soon as it and all earlier lines are done. Lines of
+// all connections go through one RequestBatcher.
+class Server {
+  public:
+    Server(ThreadPool& pool, size_t totalThreads);
+
+    // Accepts connections until SIGINT or SIGTERM. Then it stops reading
+    // from the open connections, waits until the lines already read are
+    // translated and sent, and returns. A second signal fails the lines
+    // that are still queued; their connections get an error line.
+    void Run();
+
+  private:
+    template <class Acceptor, class IoService>
+    void Accept(Acceptor& acceptor, IoService& io);
+
+    template <class Socket>
+    void Accepted(Socket& socket);
+
+    void Serve(size_t id, int inFd, int outFd);
+    void JoinFinished();
+    void Drain();
+
+    RequestBatcher batcher_;
+
+    // Connection threads by number. open_ holds the descriptors that are
+    // still read from; Serve removes its descriptor before closing it, so
+    // Drain never touches one that was closed or reused.
+    std::mutex mutex_;
+    size_t lastId_ = 0;
+    std::map<size_t, std::thread> connections_;
+    std::set<int> open_;
+    std::vector<size_t> finished_;
+};
@@ -0,0 +1,76 @@
+#include <iostream>
+#include <set>
+#include <string>
+
+#include "common/filter.h"
+#include "common/logging.h"
+#include "common/utils.h"
+#include "common/vocab.h"
+
+namespace {
+
+// The shortlist as amun built it before Filter::GetFilteredVocab used a
+// bitmap: a std::set of the first words and all translations.
+Words SetShortlist(const Filter& filter, const std::vector<Words>& mapper,
+                   const Words& srcWords, size_t maxVocabSize) {
+  std::set<Word> filtered;
+  for(size_t i = 0; i < std::min(filter.GetNumFirstWords(), maxVocabSize); ++i) {
+    filtered.insert(i);
+  }
+  for (const auto& srcWord : srcWords) {
+    for (const auto& trgWord : mapper[srcWord]) {
+      if (trgWord < maxVocabSize) {
+        filtered.insert(trgWord);
+      }
+    }
+  }
+  return Words(filtered.begin(), filtered.end());
+}
+
+}
+
+// Prints the softmax-filter shortlist of every line of stdin as target word
+// ids, the way amun filters the output layer for it. With --set, the
+// shortlists are built like before the bitmap, so that tests/Makefile can
+// compare both.
+int main(int argc, char* argv[]) {
+  bool set = argc == 6 && std::string(argv[1]) == "--set";
+  if(argc != 5 + set) {
+    std::cerr << "Usage: " << argv[0]
+              << " [--set] source.vocab target.vocab lex N < input > output" << std::endl;
+    return 1;
+  }
+  char** args = argv + 1 + set;
+
+  try {
+    spdlog::stderr_logger_mt("info");
+
+    Vocab srcVocab(args[0]);
+    Vocab trgVocab(args[1]);
+    size_t numFirstWords = std::stoul(args[3]);
+    Filter filter(srcVocab, trgVocab, args[2], numFirstWords);
+    std::vector<Words> mapper;
+    if (set) {
+      mapper = Filter::ParseAlignmentFile(srcVocab, trgVocab, args[2], 1000, numFirstWords);
+    }
+
+    std::string line;
+    while(std::getline(std::cin, line)) {
+      Words srcWords = srcVocab(line);
+      Words shortlist = set
+        ? SetShortlist(filter, mapper, srcWords, trgVocab.size())
+        : filter.GetFilteredVocab(srcWords, trgVocab.size());
+      std::vector<std::string> ids;
+      for (Word id : shortlist) {
+        ids.push_back(std::to_string(id));
+      }
+      std::cout << Join(ids) << "\n";
+    }
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
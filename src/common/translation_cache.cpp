@@ -0,0 +1,122 @@
+#include "common/translation_cache.h"
+
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+#include "common/god.h"
+#include "common/logging.h"
+#include "common/exception.h"
+
+namespace {
+
+const std::string FileHeader = "amun-translation-cache";
+
+}
+
+TranslationCache::TranslationCache(size_t capacity, const std::string& path,
+                                   size_t configHash)
+  : path_(path), configHash_(configHash), cache_(capacity)
+{
+  LOG(info) << "Caching up to " << capacity << " translations";
+  if (!path_.empty()) {
+    Load();
+  }
+}
+
+TranslationCache::~TranslationCache() {
+  if (!path_.empty()) {
+    try {
+      Save();
+    } catch(std::exception& e) {
+      std::cerr << e.what() << std::endl;
+    }
+  }
+}
+
+bool TranslationCache::Get(const Sentence& sentence, std::string& output) {
+  std::shared_ptr<const std::string> cached;
+  if (!cache_.Get(Key(sentence), cached)) {
+    return false;
+  }
+  output = *cached;
+  return true;
+}
+
+void TranslationCache::Put(const Sentence& sentence, const std::string& output) {
+  cache_.Put(Key(sentence), std::make_shared<const std::string>(output));
+}
+
+void TranslationCache::LogStatistics() const {
+  size_t hits = cache_.Hits();
+  size_t lookups = hits + cache_.Misses();
+  LOG(info) << "Translation cache: " << hits << " hits in " << lookups << " lookups ("
+            << (lookups ? 100 * hits / lookups : 0) << "%), "
+            << cache_.Size() << " entries";
+}
+
+std::string TranslationCache::Key(const Sentence& sentence) const {
+  std::stringstream key;
+  key << sentence.GetMaxLength();
+  for (size_t i = 0; i < sentence.GetInputCount(); ++i) {
+    key << "\t";
+    for (auto& word : sentence.GetWords(i)) {
+      key << word << " ";
+    }
+  }
+  // unknown words are copied from the original line into the translation
+  if (God::Has("unknown-word-placeholder")) {
+    key << "\t" << sentence.GetText();
+  }
+  return key.str();
+}
+
+// The file is a header line with the configuration hash, followed by the
+// entries as "<key size> <output size>\n<key><output>".
+void TranslationCache::Load() {
+  std::ifstream in(path_, std::ios::binary);
+  if (!in) {
+    LOG(info) << "No translation cache in " << path_ << " yet";
+    return;
+  }
+
+  std::string header;
+  size_t configHash;
+  in >> header >> configHash;
+  if (header != FileHeader || configHash != configHash_) {
+    LOG(info) << "Translation cache in " << path_
+              << " was made with other options, starting empty";
+    return;
+  }
+
+  size_t keySize, outputSize;
+  size_t entries = 0;
+  while (in >> keySize >> outputSize && in.get() == '\n') {
+    std::string key(keySize, '\0');
+    std::string output(outputSize, '\0');
+    in.read(&key[0], keySize);
+    in.read(&output[0], outputSize);
+    UTIL_THROW_IF2(!in, "Truncated translation cache " << path_);
+    cache_.Put(key, std::make_shared<const std::string>(std::move(output)));
+    ++entries;
+  }
+  LOG(info) << "Loaded " << entries << " translations from " << path_;
+}
+
+void TranslationCache::Save() const {
+  // written next to the old file first, so a crash never leaves half a cache
+  std::string temp = path_ + ".tmp";
+  {
+    std::ofstream out(temp, std::ios::binary);
+    UTIL_THROW_IF2(!out, "Cannot write translation cache " << temp);
+    out << FileHeader << " " << configHash_ << "\n";
+    cache_.ForEach([&](const std::string& key,
+                       const std::shared_ptr<const std::string>& output) {
+      out << key.size() << " " << output->size() << "\n" << key << *output;
+    });
+    UTIL_THROW_IF2(!out, "Cannot write translation cache " << temp);
+  }
+  UTIL_THROW_IF2(std::rename(temp.c_str(), path_.c_str()) != 0,
+                 "Cannot rename " << temp << " to " << path_);
+}
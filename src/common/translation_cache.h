@@ -0,0 +1,38 @@
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include "common/lru_cache.h"
+#include "common/sentence.h"
+
+// Printed translations of source lines that have been translated before,
+// keyed by the preprocessed words of the line. Entries of a cache file are
+// only used if the options that influence translations are the same.
+// Translations printed with n-best lists contain the line number, so they
+// are never cached.
+class TranslationCache {
+  public:
+    // Loads path if it is not empty and exists. configHash identifies the
+    // options the translations were made with, see Config::Hash.
+    TranslationCache(size_t capacity, const std::string& path, size_t configHash);
+
+    // Saves to the path given to the constructor, if any.
+    ~TranslationCache();
+
+    bool Get(const Sentence& sentence, std::string& output);
+
+    void Put(const Sentence& sentence, const std::string& output);
+
+    void LogStatistics() const;
+
+  private:
+    std::string Key(const Sentence& sentence) const;
+
+    void Load();
+    void Save() const;
+
+    std::string path_;
+    size_t configHash_;
+    LRUCache<std::string, std::shared_ptr<const std::string>> cache_;
+};
@@ -0,0 +1,263 @@
+#include "common/translator.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <sstream>
+#include <boost/thread/tss.hpp>
+
+#include "common/god.h"
+#include "common/logging.h"
+#include "common/search.h"
+#include "common/printer.h"
+#include "common/exception.h"
+#include "common/output_collector.h"
+#include "common/request_batcher.h"
+#include "common/translation_cache.h"
+
+namespace {
+
+size_t NextThreadId() {
+  static std::atomic<size_t> threadCounter(0);
+  return threadCounter++ % God::GetTotalThreads();
+}
+
+std::string Print(const History& history) {
+  std::stringstream ss;
+  Printer(history, history.sentence.GetLine(), ss);
+  if (TranslationCache* cache = God::GetTranslationCache()) {
+    cache->Put(history.sentence, ss.str());
+  }
+  return ss.str();
+}
+
+void Collect(const Sentences& sentences, OutputCollector& collector) {
+  std::vector<std::string> outputs = TranslateAndPrint(sentences);
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    collector.Write(sentences[i].GetLine(), outputs[i]);
+  }
+}
+
+}
+
+Histories TranslationTask(const Sentences& sentences) {
+#ifdef __APPLE__
+  static boost::thread_specific_ptr<Search> s_search;
+  Search *search = s_search.get();
+
+  if(search == NULL) {
+    LOG(info) << "Created Search for thread " << std::this_thread::get_id();
+    search = new Search(NextThreadId());
+    s_search.reset(search);
+  }
+#else
+  thread_local std::unique_ptr<Search> search;
+  if(!search) {
+    LOG(info) << "Created Search for thread " << std::this_thread::get_id();
+    search.reset(new Search(NextThreadId()));
+  }
+#endif
+
+  return search->Decode(sentences);
+}
+
+std::vector<std::string> TranslateAndPrint(const Sentences& sentences) {
+  TranslationCache* cache = God::GetTranslationCache();
+  std::vector<std::string> outputs(sentences.size());
+
+  Sentences missing;
+  std::vector<size_t> positions;
+  for (size_t i = 0; i < sentences.size(); ++i) {
+    if (!cache || !cache->Get(sentences[i], outputs[i])) {
+      missing.push_back(sentences[i]);
+      positions.push_back(i);
+    }
+  }
+
+  if (!missing.empty()) {
+    Histories histories = TranslationTask(missing);
+    for (size_t j = 0; j < histories.size(); ++j) {
+      outputs[positions[j]] = Print(histories[j]);
+    }
+  }
+  return outputs;
+}
+
+Sentences MakeSentences(const std::vector<std::string>& lines, size_t lineNo) {
+  Sentences sentences;
+  for (size_t i = 0; i < lines.size(); ++i) {
+    sentences.emplace_back(lineNo + i, lines[i]);
+  }
+  return sentences;
+}
+
+void TranslateStream(std::istream& in, std::ostream& out,
+                     ThreadPool& pool, size_t totalThreads) {
+  size_t miniBatch = God::Get<size_t>("mini-batch");
+  size_t maxiBatch = God::Get<size_t>("maxi-batch");
+  size_t preprocessThreads = God::Get<size_t>("preprocess-threads");
+  UTIL_THROW_IF2(miniBatch == 0, "mini-batch must be at least 1");
+
+  // Without a maxi-batch window, lines are grouped in input order and
+  // preprocessed by the worker. With a window, the reader preprocesses
+  // the lines itself, because sorting by length needs the BPE output.
+  // With preprocess-threads, windows are preprocessed by a pool of their
+  // own in both cases, and decoding threads only decode.
+  bool sortByLength = maxiBatch > miniBatch;
+  size_t windowSize = sortByLength ? maxiBatch : miniBatch;
+
+  // Translations are printed as soon as all earlier lines are done. The
+  // reader stops once enough lines are queued to keep every thread busy.
+  OutputCollector collector(out, windowSize * (2 * (totalThreads + preprocessThreads) + 1));
+
+  std::string line;
+  std::vector<std::string> window;
+  std::size_t lineCounter = 0;
+
+  // Queued tasks refer to the collector, so it must outlive all of them
+  // even when the reader bails out with an exception. Preprocessing tasks
+  // queue decoding tasks themselves, hence the lock.
+  std::mutex tasksMutex;
+  std::deque<std::future<void>> tasks;
+  auto enqueue = [&](ThreadPool& on, std::function<void()> task) {
+    std::lock_guard<std::mutex> lock(tasksMutex);
+    while (!tasks.empty() &&
+           tasks.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+      tasks.pop_front();
+    }
+    tasks.push_back(on.enqueue(
+      [task, &collector]{
+        try {
+          task();
+        } catch(...) {
+          collector.Abort(std::current_exception());
+        }
+      }
+    ));
+  };
+  auto waitForTasks = [&]() {
+    while (true) {
+      std::future<void> task;
+      {
+        std::lock_guard<std::mutex> lock(tasksMutex);
+        if (tasks.empty()) {
+          return;
+        }
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task.wait();
+    }
+  };
+
+  std::unique_ptr<ThreadPool> preprocessPool;
+  if (preprocessThreads > 0) {
+    preprocessPool.reset(new ThreadPool(preprocessThreads));
+  }
+
+  // Splits the sentences of a window into decoding tasks.
+  auto decode = [&](Sentences sentences) {
+    if (sortByLength) {
+      std::stable_sort(sentences.begin(), sentences.end(),
+                       [](const Sentence& a, const Sentence& b) {
+                         return a.GetWords().size() > b.GetWords().size();
+                       });
+    }
+
+    for (size_t i = 0; i < sentences.size(); i += miniBatch) {
+      Sentences batch(sentences.begin() + i,
+                      sentences.begin() + std::min(i + miniBatch, sentences.size()));
+      enqueue(pool, [=, &collector]{
+        Collect(batch, collector);
+      });
+    }
+  };
+
+  auto enqueueWindow = [&]() {
+    collector.WaitForRoom(lineCounter + window.size() - 1);
+
+    std::vector<std::string> lines;
+    lines.swap(window);
+    size_t firstLine = lineCounter;
+    lineCounter += lines.size();
+
+    if (preprocessPool) {
+      enqueue(*preprocessPool, [=, &decode]{
+        decode(MakeSentences(lines, firstLine));
+      });
+    } else if (sortByLength) {
+      decode(MakeSentences(lines, firstLine));
+    } else {
+      enqueue(pool, [=, &collector]{
+        Collect(MakeSentences(lines, firstLine), collector);
+      });
+    }
+  };
+
+  try {
+    while(std::getline(in, line)) {
+      window.push_back(line);
+      if (window.size() == windowSize) {
+        enqueueWindow();
+      }
+    }
+
+    if (!window.empty()) {
+      enqueueWindow();
+    }
+
+    collector.WaitUntil(lineCounter);
+    waitForTasks();
+  } catch(...) {
+    waitForTasks();
+    throw;
+  }
+}
+
+void TranslateStream(std::istream& in, std::ostream& out,
+                     RequestBatcher& batcher) {
+  size_t miniBatch = God::Get<size_t>("mini-batch");
+  OutputCollector collector(out, miniBatch * (2 * God::GetTotalThreads() + 1));
+
+  std::string line;
+  std::size_t lineCounter = 0;
+
+  std::deque<std::future<void>> tasks;
+  try {
+    while(std::getline(in, line)) {
+      while (!tasks.empty() &&
+             tasks.front().wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+        tasks.pop_front();
+      }
+
+      collector.WaitForRoom(lineCounter);
+      Sentence sentence(lineCounter++, line);
+
+      TranslationCache* cache = God::GetTranslationCache();
+      std::string output;
+      if (cache && cache->Get(sentence, output)) {
+        collector.Write(sentence.GetLine(), output);
+        continue;
+      }
+
+      tasks.push_back(batcher.Translate(
+        sentence,
+        [&collector](const History& history) {
+          collector.Write(history.sentence.GetLine(), Print(history));
+        },
+        [&collector](std::exception_ptr error) {
+          collector.Abort(error);
+        }
+      ));
+    }
+
+    collector.WaitUntil(lineCounter);
+  } catch(...) {
+    for (auto& task : tasks) {
+      task.wait();
+    }
+    throw;
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <iostream>
+
+#include "common/history.h"
+#include "common/sentence.h"
+#include "common/threadpool.h"
+
+class RequestBatcher;
+
+// Decodes a batch with the Search of the calling thread. Searches are
+// created on first use and numbered in creation order; the first
+// cpu-threads of them run on the CPU, the remaining ones on the GPUs.
+Histories TranslationTask(const Sentences& sentences);
+
+// The printed translations of sentences. Sentences in the translation
+// cache are not decoded, the others are decoded together and added to it.
+std::vector<std::string> TranslateAndPrint(const Sentences& sentences);
+
+Sentences MakeSentences(const std::vector<std::string>& lines, size_t lineNo);
+
+// Translates the lines of in on the pool and prints the results to out in
+// input order, each as soon as all earlier lines are done.
+void TranslateStream(std::istream& in, std::ostream& out,
+                     ThreadPool& pool, size_t totalThreads);
+
+// Same for a client of the server: every line is queued on its own and may
+// be decoded together with lines from other connections.
+void TranslateStream(std::istream& in, std::ostream& out,
+                     RequestBatcher& batcher);
@@ -1,5 +1,10 @@
 #include "common/vocab.h"
 
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
 #include <sstream>
 #include <yaml-cpp/yaml.h>
 
@@ -7,24 +12,140 @@
 #include "common/file_stream.h"
 #include "common/exception.h"
 
-Vocab::Vocab(const std::string& path) {
+const Word Vocab::NoWord;
+
+namespace {
+
+const char Magic[] = "AMUNVOC1";
+const size_t MagicSize = 8;
+
+typedef std::vector<std::pair<std::string, Word>> Entries;
+
+Entries ReadYaml(const std::string& path) {
     YAML::Node vocab = YAML::Load(InputFileStream(path));
-    for(auto&& pair : vocab) {
-      auto str = pair.first.as<std::string>();
-      auto id = pair.second.as<Word>();
-      str2id_[str] = id;
-      if(id >= id2str_.size())
-        id2str_.resize(id + 1);
-      id2str_[id] = str;
+    Entries entries;
+    for(auto&& pair : vocab)
+      entries.emplace_back(pair.first.as<std::string>(), pair.second.as<Word>());
+    return entries;
+}
+
+// Magic, number of entries as little endian uint64, then every entry as
+// id and length as little endian uint32 and the bytes of the word.
+Entries ReadBinary(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    UTIL_THROW_IF2(!in, "Cannot read vocabulary " << path);
+    std::string data((std::istreambuf_iterator<char>(in)),
+                     std::istreambuf_iterator<char>());
+
+    size_t pos = MagicSize;
+    auto read = [&](auto n) {
+      UTIL_THROW_IF2(pos + sizeof(n) > data.size(), "Vocabulary " << path << " is truncated");
+      std::memcpy(&n, data.data() + pos, sizeof(n));
+      pos += sizeof(n);
+      return (size_t)n;
+    };
+
+    size_t count = read(uint64_t());
+    UTIL_THROW_IF2(count > data.size() / (2 * sizeof(uint32_t)),
+                   "Vocabulary " << path << " is truncated");
+    Entries entries(count);
+    for(auto& entry : entries) {
+      entry.second = read(uint32_t());
+      size_t length = read(uint32_t());
+      UTIL_THROW_IF2(pos + length > data.size(), "Vocabulary " << path << " is truncated");
+      entry.first.assign(data, pos, length);
+      pos += length;
+    }
+    return entries;
+}
+
+template <class T>
+void Write(std::ostream& out, T n) {
+    out.write((const char*)&n, sizeof(n));
+}
+
+}
+
+Vocab::Vocab(const std::string& path) {
+    Entries entries = IsBinaryVocab(path) ? ReadBinary(path) : ReadYaml(path);
+    for(auto& entry : entries) {
+      UTIL_THROW_IF2(entry.second == NoWord, "Invalid id of " << entry.first << " in " << path);
+      if(entry.second >= id2str_.size())
+        id2str_.resize(entry.second + 1);
+      id2str_[entry.second] = entry.first;
     }
     UTIL_THROW_IF2(id2str_.empty(), "Empty vocabulary " << path);
-    id2str_[0] = "</s>";
+
+    size_t slots = 1;
+    while(slots < 2 * entries.size())
+      slots *= 2;
+    index_.assign(slots, NoWord);
+    // a word listed twice keeps its last id
+    for(auto& entry : entries) {
+      Word& slot = index_[Slot(entry.first)];
+      if(id2str_[entry.second] == entry.first) {
+        slot = entry.second;
+      }
+      else if(slot == NoWord || Id(slot) != entry.second) {
+        slot = id2str_.size() + aliases_.size();
+        aliases_.push_back(entry);
+      }
+    }
+}
+
+bool Vocab::IsBinaryVocab(const std::string& path) {
+    char magic[MagicSize];
+    std::ifstream in(path, std::ios::binary);
+    return in.read(magic, MagicSize) && std::memcmp(magic, Magic, MagicSize) == 0;
+}
+
+void Vocab::Save(const std::string& path) const {
+    // by id, aliases before the word that is printed for the id, so that
+    // loading the file gives the same id2str_
+    std::vector<Word> slots;
+    for(Word slot : index_)
+      if(slot != NoWord)
+        slots.push_back(slot);
+    std::sort(slots.begin(), slots.end(), [&](Word a, Word b) {
+      return std::make_pair(Id(a), a < id2str_.size())
+           < std::make_pair(Id(b), b < id2str_.size());
+    });
+
+    std::ofstream out(path, std::ios::binary);
+    UTIL_THROW_IF2(!out, "Cannot write vocabulary " << path);
+    out.write(Magic, MagicSize);
+    Write<uint64_t>(out, slots.size());
+    for(Word slot : slots) {
+      const std::string& word = Key(slot);
+      UTIL_THROW_IF2(Id(slot) > UINT32_MAX || word.size() > UINT32_MAX,
+                     "Word " << Id(slot) << " is too large for a binary vocabulary");
+      Write<uint32_t>(out, Id(slot));
+      Write<uint32_t>(out, word.size());
+      out << word;
+    }
+    UTIL_THROW_IF2(!out, "Cannot write vocabulary " << path);
+}
+
+size_t Vocab::Slot(const std::string& word) const {
+    size_t mask = index_.size() - 1;
+    size_t i = std::hash<std::string>()(word) & mask;
+    while(index_[i] != NoWord && Key(index_[i]) != word)
+      i = (i + 1) & mask;
+    return i;
+}
+
+const std::string& Vocab::Key(Word slot) const {
+    return slot < id2str_.size() ? id2str_[slot] : aliases_[slot - id2str_.size()].first;
+}
+
+Word Vocab::Id(Word slot) const {
+    return slot < id2str_.size() ? slot : aliases_[slot - id2str_.size()].second;
 }
 
 size_t Vocab::operator[](const std::string& word) const {
-    auto it = str2id_.find(word);
-    if(it != str2id_.end())
-        return it->second;
+    Word slot = index_[Slot(word)];
+    if(slot != NoWord)
+        return Id(slot);
     else
         return 1; //UNK
 }
@@ -56,8 +177,10 @@ std::vector<std::string> Vocab::operator()(const Words& sentence, bool ignoreEOS
 
 
 const std::string& Vocab::operator[](size_t id) const {
+  static const std::string EOSWord = "</s>";
   UTIL_THROW_IF2(id >= id2str_.size(), "Unknown word id: " << id);
-  return id2str_[id];
+  // the file's word for id 0 is only used to look it up
+  return id == EOS ? EOSWord : id2str_[id];
 }
 
 size_t Vocab::size() const {
@@ -1,15 +1,22 @@
 #pragma once
 
-#include <map>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "common/types.h"
 
+// Maps words to ids and back. A vocabulary is loaded once and shared by
+// all threads, so it can neither be copied nor changed.
 class Vocab {
   public:
+    // Reads the binary format written by Save if path starts with its
+    // magic, a YAML or JSON map from words to ids otherwise.
     Vocab(const std::string& path);
 
+    Vocab(const Vocab&) = delete;
+    Vocab& operator=(const Vocab&) = delete;
+
     size_t operator[](const std::string& word) const;
 
     Words operator()(const std::vector<std::string>& lineTokens, bool addEOS = true) const;
@@ -22,7 +29,28 @@ class Vocab {
 
     size_t size() const;
 
+    // Writes the words and ids in a binary format that loads much faster
+    // than YAML. A word listed twice in the original file keeps its last id,
+    // words that share an id are all kept.
+    void Save(const std::string& path) const;
+
+    static bool IsBinaryVocab(const std::string& path);
+
   private:
-    std::map<std::string, size_t> str2id_;
+    size_t Slot(const std::string& word) const;
+
+    // The word and the id of an entry of index_.
+    const std::string& Key(Word slot) const;
+    Word Id(Word slot) const;
+
     std::vector<std::string> id2str_;
+
+    // Words of the file that share their id with a later word, which is the
+    // one in id2str_.
+    std::vector<std::pair<std::string, Word>> aliases_;
+
+    // Open addressing hash table of all words in the file. A slot holds the
+    // id of id2str_[id], id2str_.size() + i for aliases_[i], or NoWord.
+    static const Word NoWord = Word(-1);
+    std::vector<Word> index_;
 };
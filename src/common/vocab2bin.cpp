@@ -0,0 +1,25 @@
+#include <iostream>
+#include <string>
+
+#include "common/vocab.h"
+
+// Converts a YAML or JSON vocabulary into amun's binary format, see
+// Vocab::Save. The result is used like the original file, e.g. in
+// source-vocab and target-vocab.
+int main(int argc, char* argv[]) {
+  if(argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " vocab.yml vocab.bin" << std::endl;
+    return 1;
+  }
+
+  try {
+    Vocab vocab(argv[1]);
+    vocab.Save(argv[2]);
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,248 @@
+#include "binary_model.h"
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "common/exception.h"
+
+namespace CPU {
+
+namespace {
+
+const char Magic[] = "AMUNBIN1";
+const size_t MagicSize = 8;
+
+std::string ConcatKey(const std::string& key1, const std::string& key2) {
+  return key1 + "|" + key2;
+}
+
+std::string TransposedKey(const std::string& key) {
+  return key + "^T";
+}
+
+// The value of field in the /proc/self/smaps entry of the mapping at
+// address, in kB.
+size_t SmapsField(const void* address, const std::string& field) {
+  std::ifstream smaps("/proc/self/smaps");
+  std::string line;
+  bool inMapping = false;
+  while(std::getline(smaps, line)) {
+    std::istringstream words(line);
+    std::string first;
+    words >> first;
+    if(first.empty()) {
+      continue;
+    }
+    if(first.back() != ':') {
+      // the header of the next mapping, "start-end perms ..."
+      inMapping = std::stoull(first.substr(0, first.find('-')), nullptr, 16)
+                  == (uintptr_t)address;
+    }
+    else if(inMapping && first == field + ":") {
+      size_t kb = 0;
+      words >> kb;
+      return kb;
+    }
+  }
+  return 0;
+}
+
+size_t RoundUp(size_t n, size_t multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+void WriteSize(std::ostream& out, uint64_t n) {
+  out.write((const char*)&n, sizeof(n));
+}
+
+}
+
+BinaryModel::BinaryModel(const std::string& file)
+  : data_(nullptr), size_(0)
+{
+  int fd = ::open(file.c_str(), O_RDONLY);
+  UTIL_THROW_IF2(fd < 0, "Cannot open binary model " << file);
+
+  struct stat st;
+  int statResult = ::fstat(fd, &st);
+  size_ = st.st_size;
+  void* mapped = statResult == 0 && size_ > 0
+               ? ::mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0)
+               : MAP_FAILED;
+  ::close(fd);
+  UTIL_THROW_IF2(mapped == MAP_FAILED, "Cannot map binary model " << file);
+  data_ = (char*)mapped;
+
+  try {
+    size_t pos = 0;
+    auto read = [&](size_t n) {
+      UTIL_THROW_IF2(pos + n > size_, "Binary model " << file << " is truncated");
+      const char* p = data_ + pos;
+      pos += n;
+      return p;
+    };
+    auto readSize = [&]() {
+      uint64_t n;
+      std::memcpy(&n, read(sizeof(n)), sizeof(n));
+      return (size_t)n;
+    };
+
+    UTIL_THROW_IF2(std::memcmp(read(MagicSize), Magic, MagicSize) != 0,
+                   file << " is not an amun binary model");
+
+    size_t count = readSize();
+    for(size_t i = 0; i < count; ++i) {
+      size_t nameLength = readSize();
+      std::string name(read(nameLength), nameLength);
+      size_t rows = readSize();
+      size_t columns = readSize();
+      size_t spacing = readSize();
+      size_t offset = readSize();
+
+      UTIL_THROW_IF2(columns > spacing || offset % Alignment != 0
+                     || offset + rows * spacing * sizeof(float) > size_,
+                     "Matrix " << name << " in binary model " << file << " is corrupt");
+
+      float* data = (float*)(data_ + offset);
+      if(rows * columns == 0) {
+        matrices_.emplace(name, mblas::WeightMatrix());
+      }
+      else if(mblas::WeightMatrix::CanView(data, columns, spacing)) {
+        matrices_.emplace(name, mblas::WeightMatrix(data, rows, columns, spacing));
+      }
+      else {
+        typedef blaze::CustomMatrix<float, blaze::unaligned, blaze::unpadded,
+                                    blaze::rowMajor> Unaligned;
+        matrices_.emplace(name, mblas::WeightMatrix(Unaligned(data, rows, columns, spacing)));
+      }
+    }
+  }
+  catch(...) {
+    ::munmap(data_, size_);
+    throw;
+  }
+}
+
+BinaryModel::~BinaryModel() {
+  matrices_.clear();
+  ::munmap(data_, size_);
+}
+
+bool BinaryModel::IsBinaryModel(const std::string& file) {
+  std::ifstream in(file, std::ios::binary);
+  char magic[MagicSize];
+  return in.read(magic, MagicSize) && std::memcmp(magic, Magic, MagicSize) == 0;
+}
+
+mblas::WeightMatrix BinaryModel::operator[](const std::string& key) const {
+  auto it = matrices_.find(key);
+  if(it != matrices_.end()) {
+    return it->second;
+  }
+  else {
+    std::cerr << "Missing " << key << std::endl;
+    return mblas::WeightMatrix();
+  }
+}
+
+mblas::WeightMatrix BinaryModel::operator()(const std::string& key,
+                                            bool) const {
+  return (*this)[key];
+}
+
+mblas::WeightMatrix BinaryModel::Concat(const std::string& key1,
+                                        const std::string& key2) const {
+  return (*this)[ConcatKey(key1, key2)];
+}
+
+mblas::WeightMatrix BinaryModel::Transposed(const std::string& key) const {
+  auto it = matrices_.find(TransposedKey(key));
+  return it != matrices_.end() ? it->second : mblas::WeightMatrix();
+}
+
+size_t BinaryModel::ResidentKB() const {
+  return SmapsField(data_, "Rss");
+}
+
+size_t BinaryModel::CopiedKB() const {
+  return SmapsField(data_, "Private_Dirty");
+}
+
+//////////////////////////////////////////////////////////////////////////////
+
+BinaryModelWriter::BinaryModelWriter(const NpzConverter& model)
+  : model_(model)
+{}
+
+mblas::Matrix BinaryModelWriter::operator[](const std::string& key) const {
+  return matrices_[key] = model_[key];
+}
+
+mblas::Matrix BinaryModelWriter::operator()(const std::string& key,
+                                            bool transpose) const {
+  return matrices_[key] = model_(key, transpose);
+}
+
+mblas::Matrix BinaryModelWriter::Concat(const std::string& key1,
+                                        const std::string& key2) const {
+  return matrices_[ConcatKey(key1, key2)] = model_.Concat(key1, key2);
+}
+
+mblas::Matrix BinaryModelWriter::Transposed(const std::string& key) const {
+  return matrices_[TransposedKey(key)] = blaze::trans(model_[key]);
+}
+
+void BinaryModelWriter::Save(const std::string& file) const {
+  size_t headerSize = MagicSize + sizeof(uint64_t);
+  for(auto& it : matrices_) {
+    headerSize += sizeof(uint64_t) + it.first.size() + 4 * sizeof(uint64_t);
+  }
+
+  std::ofstream out(file, std::ios::binary);
+  UTIL_THROW_IF2(!out, "Cannot write binary model " << file);
+
+  out.write(Magic, MagicSize);
+  WriteSize(out, matrices_.size());
+
+  size_t offset = RoundUp(headerSize, BinaryModel::Alignment);
+  for(auto& it : matrices_) {
+    const mblas::Matrix& m = it.second;
+    size_t spacing = mblas::WeightMatrix::Spacing(m.columns());
+
+    WriteSize(out, it.first.size());
+    out.write(it.first.data(), it.first.size());
+    WriteSize(out, m.rows());
+    WriteSize(out, m.columns());
+    WriteSize(out, spacing);
+    WriteSize(out, offset);
+
+    offset += RoundUp(m.rows() * spacing * sizeof(float), BinaryModel::Alignment);
+  }
+
+  std::vector<char> zeros(BinaryModel::Alignment, 0);
+  auto pad = [&]() {
+    size_t written = out.tellp();
+    out.write(zeros.data(), RoundUp(written, BinaryModel::Alignment) - written);
+  };
+
+  pad();
+  for(auto& it : matrices_) {
+    const mblas::Matrix& m = it.second;
+    size_t padding = mblas::WeightMatrix::Spacing(m.columns()) - m.columns();
+    for(size_t i = 0; i < m.rows(); ++i) {
+      out.write((const char*)m.data(i), m.columns() * sizeof(float));
+      out.write(zeros.data(), padding * sizeof(float));
+    }
+    pad();
+  }
+
+  UTIL_THROW_IF2(!out, "Cannot write binary model " << file);
+}
+
+}
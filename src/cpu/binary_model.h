@@ -0,0 +1,88 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "npz_converter.h"
+#include "mblas/matrix.h"
+
+namespace CPU {
+
+// Amun's own model format. It holds the matrices of Weights in the layout
+// they are used in (transposed biases, concatenated GRU blocks), each one
+// aligned for SIMD access, so the file is memory-mapped and used in place:
+// loading is nearly free and the pages are shared by all processes that
+// map the same file. Rows are padded with zeros to the SIMD width of the
+// writer; a reader built for a wider one copies the matrices instead. The
+// mapping is read-only, so its pages are never copied into a process.
+//
+// Layout, all integers are little-endian uint64:
+//   "AMUNBIN1" count
+//   count x { nameLength name rows columns spacing offset }
+//   matrix data, each at an offset that is a multiple of Alignment, rows
+//   of spacing floats of which the first columns are used and the rest
+//   are zero.
+class BinaryModel {
+  public:
+    static const size_t Alignment = 64;
+
+    BinaryModel(const std::string& file);
+    ~BinaryModel();
+
+    BinaryModel(const BinaryModel&) = delete;
+    BinaryModel& operator=(const BinaryModel&) = delete;
+
+    static bool IsBinaryModel(const std::string& file);
+
+    // The same interface as NpzConverter. Matrices are stored in their
+    // final shape, so the transpose flag and concatenation only select the
+    // name they were saved under.
+    mblas::WeightMatrix operator[](const std::string& key) const;
+
+    mblas::WeightMatrix operator()(const std::string& key,
+                                   bool transpose) const;
+
+    mblas::WeightMatrix Concat(const std::string& key1,
+                               const std::string& key2) const;
+
+    // The transpose of matrix key if the writer stored one, empty otherwise.
+    mblas::WeightMatrix Transposed(const std::string& key) const;
+
+    // Kilobytes of the mapping that are resident in memory and that were
+    // copied into this process, from /proc/self/smaps. Both are 0 where
+    // that file does not exist.
+    size_t ResidentKB() const;
+    size_t CopiedKB() const;
+
+  private:
+    char* data_;
+    size_t size_;
+    std::map<std::string, mblas::WeightMatrix> matrices_;
+};
+
+// Reads an npz model through NpzConverter and keeps every matrix Weights
+// asks for, under the name BinaryModel will look it up by. Constructing
+// Weights from a writer and calling Save converts a model.
+class BinaryModelWriter {
+  public:
+    BinaryModelWriter(const NpzConverter& model);
+
+    mblas::Matrix operator[](const std::string& key) const;
+
+    mblas::Matrix operator()(const std::string& key,
+                             bool transpose) const;
+
+    mblas::Matrix Concat(const std::string& key1,
+                         const std::string& key2) const;
+
+    // Stores the transpose of matrix key as well, for BinaryModel::Transposed.
+    mblas::Matrix Transposed(const std::string& key) const;
+
+    void Save(const std::string& file) const;
+
+  private:
+    const NpzConverter& model_;
+    mutable std::map<std::string, mblas::Matrix> matrices_;
+};
+
+}
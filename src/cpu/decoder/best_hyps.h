@@ -7,133 +7,181 @@
 #include "common/god.h"
 #include "common/exception.h"
 #include "cpu/mblas/matrix.h"
+#include "cpu/mblas/elementwise.h"
 
 namespace CPU {
 
-struct ProbCompare {
-  ProbCompare(const float* data) : data_(data) {}
-
-  bool operator()(const unsigned a, const unsigned b) {
-    return data_[a] > data_[b];
-  }
-
-  const float* data_;
-};
-
-void BestHyps(Beam& bestHyps,
-    const Beam& prevHyps,
-		const size_t beamSize,
+void BestHyps(Beams& bestHyps,
+    const Beams& prevHyps,
+		const std::vector<size_t>& beamSizes,
 		const std::vector<ScorerPtr> &scorers,
 		const Words &filterIndices,
-    bool returnAlignment)
+    bool returnAlignment,
+    const std::vector<HypothesisArena*>& arenas)
 {
   using namespace mblas;
 
   auto& weights = God::GetScorerWeights();
 
-  mblas::ArrayMatrix& Probs = static_cast<mblas::ArrayMatrix&>(scorers[0]->GetProbs());
-
-  mblas::ArrayMatrix Costs(Probs.rows(), 1);
-  for (size_t i = 0; i < prevHyps.size(); ++i) {
-    Costs.data()[i] = prevHyps[i]->GetCost();
+  bool doBreakdown = God::Get<bool>("n-best");
+  bool filter = God::Get<std::vector<std::string>>("softmax-filter").size();
+  bool allowUnk = God::Get<bool>("allow-unk");
+
+  // A single scorer without breakdowns needs the best few words of each row
+  // only, which are found on its unnormalized scores; see
+  // mblas::LogSoftmaxTopK. Otherwise the log probabilities of all scorers
+  // are summed up first.
+  CPU::EncoderDecoder* single = nullptr;
+  if (scorers.size() == 1 && !doBreakdown && weights[scorers[0]->GetName()] > 0) {
+    single = dynamic_cast<CPU::EncoderDecoder*>(scorers[0].get());
   }
 
-  Probs *= weights[scorers[0]->GetName()];
-  AddBiasVector<byColumn>(Probs, Costs);
+  mblas::ArrayMatrix* Probs = nullptr;
+  size_t columns;
+  if (single) {
+    columns = single->GetLogits().columns();
+  } else {
+    Probs = &static_cast<mblas::ArrayMatrix&>(scorers[0]->GetProbs());
+    columns = Probs->columns();
+
+    mblas::ArrayMatrix Costs(Probs->rows(), 1);
+    size_t row = 0;
+    for (auto& beam : prevHyps) {
+      for (auto& hyp : beam) {
+        Costs.data()[row++] = hyp->GetCost();
+      }
+    }
 
-  for (size_t i = 1; i < scorers.size(); ++i) {
-	  mblas::ArrayMatrix &currProb = static_cast<mblas::ArrayMatrix&>(scorers[i]->GetProbs());
+    *Probs *= weights[scorers[0]->GetName()];
+    AddBiasVector<byColumn>(*Probs, Costs);
 
-	  Probs += weights[scorers[i]->GetName()] * currProb;
-  }
+    for (size_t i = 1; i < scorers.size(); ++i) {
+      mblas::ArrayMatrix &currProb = static_cast<mblas::ArrayMatrix&>(scorers[i]->GetProbs());
 
-  size_t size = Probs.rows() * Probs.columns(); // Probs.size();
-  std::vector<size_t> keys(size);
-  for (size_t i = 0; i < keys.size(); ++i) {
-    keys[i] = i;
+      *Probs += weights[scorers[i]->GetName()] * currProb;
+    }
+
+    if (!allowUnk) {
+      blaze::column(*Probs, UNK) = std::numeric_limits<float>::lowest();
+    }
   }
 
-  std::vector<size_t> bestKeys(beamSize);
-  std::vector<float> bestCosts(beamSize);
+  // The rows of Probs are the concatenated beams of all sentences in the
+  // batch; offset is the first row of the current sentence.
+  size_t offset = 0;
+  for (size_t batchId = 0; batchId < prevHyps.size(); ++batchId) {
+    const Beam& prevBeam = prevHyps[batchId];
+    size_t beamSize = beamSizes[batchId];
+    if (beamSize == 0) {
+      continue;
+    }
 
-  if (!God::Get<bool>("allow-unk")) {
-    blaze::column(Probs, UNK) = std::numeric_limits<float>::lowest();
-  }
+    std::vector<size_t> bestKeys;
+    std::vector<float> bestCosts;
+
+    // Reused by the steps of all sentences decoded by this thread.
+    static thread_local std::vector<mblas::Candidate> best;
+
+    if (single) {
+      const mblas::Matrix& Logits = single->GetLogits();
+      float weight = weights[single->GetName()];
+
+      // (cost, key) of the best words of every row
+      static thread_local std::vector<std::pair<float, size_t>> candidates;
+      candidates.clear();
+      for (size_t i = 0; i < prevBeam.size(); ++i) {
+        size_t row = offset + i;
+        mblas::LogSoftmaxTopK(best, Logits.data(row), columns, beamSize,
+                              allowUnk ? columns : UNK);
+        for (auto& candidate : best) {
+          candidates.emplace_back(weight * candidate.score + prevBeam[i]->GetCost(),
+                                  row * columns + candidate.column);
+        }
+      }
 
-  std::nth_element(keys.begin(), keys.begin() + beamSize, keys.end(),
-		           ProbCompare(Probs.data()));
+      beamSize = std::min(beamSize, candidates.size());
+      std::partial_sort(candidates.begin(), candidates.begin() + beamSize, candidates.end(),
+                        [](const std::pair<float, size_t>& a, const std::pair<float, size_t>& b) {
+                          return a.first > b.first || (a.first == b.first && a.second < b.second);
+                        });
 
-  for (size_t i = 0; i < beamSize; ++i) {
-    bestKeys[i] = keys[i];
-    bestCosts[i] = Probs.data()[keys[i]];
-  }
+      for (size_t i = 0; i < beamSize; ++i) {
+        bestCosts.push_back(candidates[i].first);
+        bestKeys.push_back(candidates[i].second);
+      }
+    } else {
+      size_t begin = offset * columns;
+      mblas::TopK(best, Probs->data() + begin, prevBeam.size() * columns, beamSize);
 
-  std::vector<std::vector<float>> breakDowns;
-  bool doBreakdown = God::Get<bool>("n-best");
-  if (doBreakdown) {
-    breakDowns.push_back(bestCosts);
-    for (auto& scorer : scorers) {
-      std::vector<float> modelCosts(beamSize);
-      mblas::ArrayMatrix &currProb = static_cast<mblas::ArrayMatrix&>(scorer->GetProbs());
-
-      auto it = boost::make_permutation_iterator(currProb.begin(), keys.begin());
-      std::copy(it, it + beamSize, modelCosts.begin());
-      breakDowns.push_back(modelCosts);
+      beamSize = best.size();
+      for (auto& candidate : best) {
+        bestKeys.push_back(begin + candidate.column);
+        bestCosts.push_back(candidate.score);
+      }
     }
-  }
-
-  bool filter = God::Get<std::vector<std::string>>("softmax-filter").size();
 
-  for (size_t i = 0; i < beamSize; i++) {
-    size_t wordIndex = bestKeys[i] % Probs.columns();
+    std::vector<std::vector<float>> breakDowns;
+    if (doBreakdown) {
+      breakDowns.push_back(bestCosts);
+      for (auto& scorer : scorers) {
+        std::vector<float> modelCosts(beamSize);
+        mblas::ArrayMatrix &currProb = static_cast<mblas::ArrayMatrix&>(scorer->GetProbs());
 
-    if (filter) {
-      wordIndex = filterIndices[wordIndex];
+        auto it = boost::make_permutation_iterator(currProb.begin(), bestKeys.begin());
+        std::copy(it, it + beamSize, modelCosts.begin());
+        breakDowns.push_back(modelCosts);
+      }
     }
 
-    size_t hypIndex  = bestKeys[i] / Probs.columns();
-    float cost = bestCosts[i];
+    for (size_t i = 0; i < beamSize; i++) {
+      size_t wordIndex = bestKeys[i] % columns;
 
-    HypothesisPtr hyp;
-    if (returnAlignment) {
-      std::vector<SoftAlignmentPtr> alignments;
-      for (auto& scorer : scorers) {
-        if (CPU::EncoderDecoder* encdec = dynamic_cast<CPU::EncoderDecoder*>(scorer.get())) {
-          auto& attention = encdec->GetAttention();
-          alignments.emplace_back(new SoftAlignment(attention.begin(hypIndex),
-                                                    attention.end(hypIndex)));
-        } else {
-          UTIL_THROW2("Return Alignment is allowed only with Nematus scorer.");
-        }
+      if (filter) {
+        wordIndex = filterIndices[wordIndex];
       }
 
-      hyp.reset(new Hypothesis(prevHyps[hypIndex], wordIndex, hypIndex, cost, alignments));
-    } else {
-      hyp.reset(new Hypothesis(prevHyps[hypIndex], wordIndex, hypIndex, cost));
-    }
+      size_t hypIndex  = bestKeys[i] / columns;
+      const HypothesisPtr& prevHyp = prevBeam[hypIndex - offset];
+      float cost = bestCosts[i];
+
+      HypothesisArena& arena = *arenas[batchId];
+      HypothesisPtr hyp = arena.New(prevHyp, wordIndex, hypIndex, cost);
+
+      if (returnAlignment) {
+        for (size_t j = 0; j < scorers.size(); ++j) {
+          if (CPU::EncoderDecoder* encdec = dynamic_cast<CPU::EncoderDecoder*>(scorers[j].get())) {
+            auto& attention = encdec->GetAttention();
+            size_t words = encdec->GetSourceLength(batchId);
+            arena.SetAlignmentSize(scorers.size(), words);
+            std::copy(attention.begin(hypIndex), attention.begin(hypIndex) + words,
+                      arena.GetAlignment(*hyp, j));
+          } else {
+            UTIL_THROW2("Return Alignment is allowed only with Nematus scorer.");
+          }
+        }
+      }
 
-    if (doBreakdown) {
-      hyp->GetCostBreakdown().resize(scorers.size());
-      float sum = 0;
-      for(size_t j = 0; j < scorers.size(); ++j) {
-        if (j == 0) {
-          hyp->GetCostBreakdown()[0] = breakDowns[0][i];
-        } else {
-          float cost = 0;
-          if (j < scorers.size()) {
-            if (prevHyps[hypIndex]->GetCostBreakdown().size() < scorers.size())
-              const_cast<HypothesisPtr&>(prevHyps[hypIndex])->GetCostBreakdown().resize(scorers.size(), 0.0);
-            cost = breakDowns[j][i] + const_cast<HypothesisPtr&>(prevHyps[hypIndex])->GetCostBreakdown()[j];
+      if (doBreakdown) {
+        arena.SetBreakdownSize(scorers.size());
+        float* breakdown = arena.GetCostBreakdown(*hyp);
+        const float* prevBreakdown = arena.GetCostBreakdown(*prevHyp);
+        float sum = 0;
+        for(size_t j = 0; j < scorers.size(); ++j) {
+          if (j == 0) {
+            breakdown[0] = breakDowns[0][i];
+          } else {
+            float cost = breakDowns[j][i] + prevBreakdown[j];
+            sum += weights[scorers[j]->GetName()] * cost;
+            breakdown[j] = cost;
           }
-          sum += weights[scorers[j]->GetName()] * cost;
-          hyp->GetCostBreakdown()[j] = cost;
         }
+        breakdown[0] -= sum;
+        breakdown[0] /= weights[scorers[0]->GetName()];
       }
-      hyp->GetCostBreakdown()[0] -= sum;
-      hyp->GetCostBreakdown()[0] /= weights[scorers[0]->GetName()];
+      bestHyps[batchId].push_back(hyp);
     }
-    bestHyps.push_back(hyp);
-  }
 
+    offset += prevBeam.size();
+  }
 }
 }
@@ -14,6 +14,7 @@
 #include "common/sentence.h"
 
 #include "cpu/mblas/matrix.h"
+#include "cpu/mblas/int16.h"
 #include "cpu/decoder/best_hyps.h"
 
 using namespace std;
@@ -49,15 +50,25 @@ const CPU::mblas::Matrix& EncoderDecoderState::GetEmbeddings() const {
   return embeddings_;
 }
 
+std::vector<size_t>& EncoderDecoderState::GetBeamSizes() {
+  return beamSizes_;
+}
+
+const std::vector<size_t>& EncoderDecoderState::GetBeamSizes() const {
+  return beamSizes_;
+}
+
 ////////////////////////////////////////////////
 EncoderDecoder::EncoderDecoder(const std::string& name,
                                const YAML::Node& config,
                                size_t tab,
-                               const Weights& model)
+                               const Weights& model,
+                               std::shared_ptr<EncoderCache> cache)
   : Scorer(name, config, tab),
     model_(model),
     encoder_(new CPU::Encoder(model_)),
-    decoder_(new CPU::Decoder(model_))
+    decoder_(new CPU::Decoder(model_)),
+    cache_(cache)
 {}
 
 void EncoderDecoder::Score(const State& in, State& out) {
@@ -65,7 +76,8 @@ void EncoderDecoder::Score(const State& in, State& out) {
   EDState& edOut = out.get<EDState>();
 
   decoder_->MakeStep(edOut.GetStates(), edIn.GetStates(),
-                     edIn.GetEmbeddings(), SourceContext_);
+                     edIn.GetEmbeddings(), SourceContexts_,
+                     edIn.GetBeamSizes());
 }
 
 State* EncoderDecoder::NewState() {
@@ -74,28 +86,77 @@ State* EncoderDecoder::NewState() {
 
 void EncoderDecoder::BeginSentenceState(State& state) {
   EDState& edState = state.get<EDState>();
-  decoder_->EmptyState(edState.GetStates(), SourceContext_, 1);
-  decoder_->EmptyEmbedding(edState.GetEmbeddings(), 1);
+  decoder_->EmptyState(edState.GetStates(), SourceContexts_, SCUs_);
+  decoder_->EmptyEmbedding(edState.GetEmbeddings(), SourceContexts_.size());
+  edState.GetBeamSizes().assign(SourceContexts_.size(), 1);
 }
 
 void EncoderDecoder::SetSource(const Sentence& source) {
-  encoder_->GetContext(source.GetWords(tab_),
-                        SourceContext_);
+  SetSource(Sentences(1, source));
 }
 
 void EncoderDecoder::AssembleBeamState(const State& in,
                                        const Beam& beam,
                                        State& out) {
+  AssembleBeamState(in, Beams(1, beam), out);
+}
+
+bool EncoderDecoder::SupportsBatching() const {
+  return true;
+}
+
+void EncoderDecoder::SetSource(const Sentences& sources) {
+  SourceContexts_.resize(sources.size());
+  SCUs_.resize(sources.size());
+
+  // Sentences that are not cached are encoded together.
+  std::vector<std::vector<size_t>> words;
+  std::vector<size_t> encoded;
+  for (size_t i = 0; i < sources.size(); ++i) {
+    const Words& source = sources[i].GetWords(tab_);
+    std::shared_ptr<const EncodedSource> cached;
+    if (cache_ && cache_->Get(source, cached)) {
+      SourceContexts_[i] = cached->Context;
+      SCUs_[i] = cached->SCU;
+    } else {
+      words.push_back(source);
+      encoded.push_back(i);
+    }
+  }
+  if (words.empty()) {
+    return;
+  }
+
+  std::vector<mblas::Matrix> contexts;
+  encoder_->GetContexts(words, contexts);
+  for (size_t j = 0; j < encoded.size(); ++j) {
+    size_t i = encoded[j];
+    SourceContexts_[i] = std::move(contexts[j]);
+    decoder_->ProjectSource(SCUs_[i], SourceContexts_[i]);
+    if (cache_) {
+      cache_->Put(words[j], std::make_shared<EncodedSource>(
+                              EncodedSource{SourceContexts_[i], SCUs_[i]}));
+    }
+  }
+}
+
+void EncoderDecoder::AssembleBeamState(const State& in,
+                                       const Beams& beams,
+                                       State& out) {
   std::vector<size_t> beamWords;
   std::vector<size_t> beamStateIds;
-  for(auto h : beam) {
+  const EDState& edIn = in.get<EDState>();
+  EDState& edOut = out.get<EDState>();
+
+  edOut.GetBeamSizes().clear();
+  for (auto& beam : beams) {
+    for (auto h : beam) {
       beamWords.push_back(h->GetWord());
       beamStateIds.push_back(h->GetPrevStateIndex());
+    }
+    edOut.GetBeamSizes().push_back(beam.size());
   }
 
-  const EDState& edIn = in.get<EDState>();
-  EDState& edOut = out.get<EDState>();
-
   edOut.GetStates() = mblas::Assemble<mblas::byRow, mblas::Matrix>(edIn.GetStates(), beamStateIds);
   decoder_->Lookup(edOut.GetEmbeddings(), beamWords);
 }
@@ -112,10 +173,19 @@ size_t EncoderDecoder::GetVocabSize() const {
   return decoder_->GetVocabSize();
 }
 
+size_t EncoderDecoder::GetSourceLength(size_t batchId) const {
+  return SourceContexts_[batchId].rows();
+}
+
 void EncoderDecoder::Filter(const std::vector<size_t>& filterIds) {
   decoder_->Filter(filterIds);
 }
 
+void EncoderDecoder::Filter(const std::vector<size_t>& filterIds,
+                            const std::vector<std::vector<size_t>>& excluded) {
+  decoder_->Filter(filterIds, excluded);
+}
+
 Encoder& EncoderDecoder::GetEncoder() {
   return *encoder_;
 }
@@ -128,23 +198,84 @@ BaseMatrix& EncoderDecoder::GetProbs() {
   return decoder_->GetProbs();
 }
 
+const mblas::Matrix& EncoderDecoder::GetLogits() const {
+  return decoder_->GetLogits();
+}
+
 
 ////////////////////////////////////////////////
 EncoderDecoderLoader::EncoderDecoderLoader(const std::string name,
                                            const YAML::Node& config)
   : Loader(name, config) {}
 
+EncoderDecoderLoader::~EncoderDecoderLoader() {
+  if(binaryModel_) {
+    // pages that were written to are no longer shared with other processes
+    LOG(info) << "Binary model of " << name_ << ": " << binaryModel_->ResidentKB()
+              << " kB resident, " << binaryModel_->CopiedKB() << " kB copied";
+  }
+  if(encoderCache_) {
+    LOG(info) << "Encoder cache of " << name_ << ": " << encoderCache_->Hits()
+              << " hits, " << encoderCache_->Misses() << " misses";
+  }
+}
+
 void EncoderDecoderLoader::Load() {
   std::string path = Get<std::string>("path");
 
   LOG(info) << "Loading model " << path;
-  weights_.emplace_back(new Weights(path, 0));
+  if(BinaryModel::IsBinaryModel(path)) {
+    binaryModel_.reset(new BinaryModel(path));
+    weights_.emplace_back(new Weights(*binaryModel_, 0));
+  }
+  else {
+    weights_.emplace_back(new Weights(path, 0));
+  }
+
+  if(Has("precompute-embeddings") && Get<bool>("precompute-embeddings")) {
+    weights_[0]->PrecomputeEmbeddings();
+    const mblas::Matrix& projections = weights_[0]->decEmbeddingProjections_;
+    LOG(info) << "Precomputed target embedding projections of " << name_ << ": "
+              << projections.rows() << "x" << projections.columns() << ", "
+              << projections.rows() * projections.spacing() * sizeof(float) / (1 << 20)
+              << " MB";
+  }
+
+  if(Has("quantize")) {
+    std::string quantize = Get<std::string>("quantize");
+    UTIL_THROW_IF2(quantize != "int16",
+                   "Unknown quantization " << quantize << " for scorer " << name_);
+    std::string kernel = God::Get<std::string>("int16-kernel");
+    UTIL_THROW_IF2(!mblas::SetInt16Kernel(kernel),
+                   "Unknown int16 kernel " << kernel << " or not supported by this CPU");
+    LOG(info) << "Quantizing decoder of " << name_ << " to " << quantize
+              << " with the " << mblas::GetInt16Kernel() << " kernel";
+    weights_[0]->Quantize();
+  }
+  else if(!God::Get<std::vector<std::string>>("softmax-filter").empty()) {
+    // the decoder gathers the columns of filtered output layers from it
+    if(weights_[0]->TransposeOutputLayer(binaryModel_.get())) {
+      LOG(info) << "Using the transposed output layer of " << name_
+                << " in the binary model for the softmax filter";
+    }
+    else {
+      const mblas::WeightMatrix& W4T = *weights_[0]->decSoftmaxW4T_;
+      LOG(info) << "Transposed output layer of " << name_ << " for the softmax filter: "
+                << W4T.rows() * W4T.spacing() * sizeof(float) / (1 << 20)
+                << " MB, convert the model with npz2bin to share it between processes";
+    }
+  }
+
+  size_t cacheSize = God::Get<size_t>("encoder-cache-size");
+  if(cacheSize > 0) {
+    encoderCache_.reset(new EncoderCache(cacheSize));
+  }
 }
 
 ScorerPtr EncoderDecoderLoader::NewScorer(const size_t) {
   size_t tab = Has("tab") ? Get<size_t>("tab") : 0;
   return ScorerPtr(new EncoderDecoder(name_, config_,
-                                      tab, *weights_[0]));
+                                      tab, *weights_[0], encoderCache_));
 }
 
 BestHypsType EncoderDecoderLoader::GetBestHyps() {
@@ -1,9 +1,12 @@
 #pragma once
 
+#include <memory>
 #include <vector>
 #include <yaml-cpp/yaml.h>
+#include <boost/functional/hash.hpp>
 
 #include "common/threadpool.h"
+#include "common/lru_cache.h"
 
 #include "common/god.h"
 #include "common/loader.h"
@@ -33,11 +36,33 @@ class EncoderDecoderState : public State {
 
     const CPU::mblas::Matrix& GetEmbeddings() const;
 
+    std::vector<size_t>& GetBeamSizes();
+
+    const std::vector<size_t>& GetBeamSizes() const;
+
   private:
     //EncoderDecoderState();
 
     CPU::mblas::Matrix states_;
     CPU::mblas::Matrix embeddings_;
+    // number of consecutive rows of states_ belonging to each sentence
+    std::vector<size_t> beamSizes_;
+};
+
+////////////////////////////////////////////////
+// What the decoder needs of a source sentence: the encoder output and its
+// projection for the attention.
+struct EncodedSource {
+  mblas::Matrix Context;
+  mblas::Matrix SCU;
+};
+
+// Encoded sentences of one model by their source words, shared by the
+// scorers of all threads.
+class EncoderCache
+  : public LRUCache<Words, std::shared_ptr<const EncodedSource>, boost::hash<Words>> {
+  public:
+    using LRUCache::LRUCache;
 };
 
 ////////////////////////////////////////////////
@@ -49,7 +74,8 @@ class EncoderDecoder : public Scorer {
     EncoderDecoder(const std::string& name,
                    const YAML::Node& config,
                    size_t tab,
-                   const Weights& model);
+                   const Weights& model,
+                   std::shared_ptr<EncoderCache> cache = nullptr);
 
     virtual void Score(const State& in, State& out);
 
@@ -63,15 +89,30 @@ class EncoderDecoder : public Scorer {
                                    const Beam& beam,
                                    State& out);
 
+    virtual bool SupportsBatching() const;
+
+    virtual void SetSource(const Sentences& sources);
+
+    virtual void AssembleBeamState(const State& in,
+                                   const Beams& beams,
+                                   State& out);
+
     void GetAttention(mblas::Matrix& Attention);
     mblas::Matrix& GetAttention();
 
     size_t GetVocabSize() const;
 
+    size_t GetSourceLength(size_t batchId) const;
+
     BaseMatrix& GetProbs();
 
+    const mblas::Matrix& GetLogits() const;
+
     void Filter(const std::vector<size_t>& filterIds);
 
+    void Filter(const std::vector<size_t>& filterIds,
+                const std::vector<std::vector<size_t>>& excluded);
+
     CPU::Encoder& GetEncoder();
 
     CPU::Decoder& GetDecoder();
@@ -80,8 +121,10 @@ class EncoderDecoder : public Scorer {
     const Weights& model_;
     std::unique_ptr<CPU::Encoder> encoder_;
     std::unique_ptr<CPU::Decoder> decoder_;
+    std::shared_ptr<EncoderCache> cache_;
 
-    mblas::Matrix SourceContext_;
+    std::vector<mblas::Matrix> SourceContexts_;
+    std::vector<mblas::Matrix> SCUs_;
 };
 
 }
@@ -12,19 +12,26 @@
 namespace CPU {
 
 class Weights;
+class BinaryModel;
+class EncoderCache;
 
 class EncoderDecoderLoader : public Loader {
   public:
     EncoderDecoderLoader(const std::string name,
                          const YAML::Node& config);
 
+    virtual ~EncoderDecoderLoader();
+
     virtual void Load();
 
     virtual ScorerPtr NewScorer(const size_t taskId);
     BestHypsType GetBestHyps();
 
   private:
+    // keeps the mapped model alive as long as the weights that view it
+    std::unique_ptr<BinaryModel> binaryModel_;
     std::vector<std::unique_ptr<Weights>> weights_;
+    std::shared_ptr<EncoderCache> encoderCache_;
 };
 
 } // namespace CPU
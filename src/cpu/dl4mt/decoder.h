@@ -1,6 +1,10 @@
 #pragma once
 
+#include <limits>
+
 #include "../mblas/matrix.h"
+#include "../mblas/int16.h"
+#include "../mblas/elementwise.h"
 #include "model.h"
 #include "gru.h"
 #include "common/god.h"
@@ -12,17 +16,26 @@ class Decoder {
     template <class Weights>
     class Embeddings {
       public:
-        Embeddings(const Weights& model)
-        : w_(model)
+        Embeddings(const Weights& model, const mblas::Matrix& projections)
+        : w_(model), projections_(projections)
         {}
 
+        // The embeddings of ids, or their rows of the precomputed
+        // projections if there are any, see Weights::PrecomputeEmbeddings.
         void Lookup(mblas::Matrix& Rows, const std::vector<size_t>& ids) {
           using namespace mblas;
           std::vector<size_t> tids = ids;
           for(auto&& id : tids)
             if(id >= w_.E_.rows())
               id = 1;
-          Rows = Assemble<byRow, Matrix>(w_.E_, tids);
+          if(IsProjected())
+            Rows = Assemble<byRow, Matrix>(projections_, tids);
+          else
+            Rows = Assemble<byRow, Matrix>(w_.E_, tids);
+        }
+
+        bool IsProjected() const {
+          return projections_.rows() > 0;
         }
 
         size_t GetCols() {
@@ -35,6 +48,7 @@ class Decoder {
 
       private:
         const Weights& w_;
+        const mblas::Matrix& projections_;
     };
 
     //////////////////////////////////////////////////////////////
@@ -45,16 +59,16 @@ class Decoder {
         : w_(initModel), gru_(gruModel) {}
 
         void InitializeState(mblas::Matrix& State,
-                             const mblas::Matrix& SourceContext,
-                             const size_t batchSize = 1) {
+                             const std::vector<mblas::Matrix>& SourceContexts) {
           using namespace mblas;
 
-          // Calculate mean of source context, rowwise
-          // Repeat mean batchSize times by broadcasting
-          Temp1_ = Mean<byRow, Matrix>(SourceContext);
-          Temp2_.resize(batchSize, SourceContext.columns());
-          Temp2_ = 0.0f;
-          AddBiasVector<byRow>(Temp2_, Temp1_);
+          // Calculate mean of every source context, rowwise,
+          // one row per sentence in the batch
+          Temp2_.resize(SourceContexts.size(), SourceContexts[0].columns());
+          for (size_t i = 0; i < SourceContexts.size(); ++i) {
+            Temp1_ = Mean<byRow, Matrix>(SourceContexts[i]);
+            blaze::row(Temp2_, i) = blaze::row(Temp1_, 0);
+          }
 
           State = Temp2_ * w_.Wi_;
           AddBiasVector<byRow>(State, w_.Bi_);
@@ -68,6 +82,18 @@ class Decoder {
           gru_.GetNextState(NextState, State, Context);
         }
 
+        // Embeddings are rows of Weights::decEmbeddingProjections_, whose
+        // first columns are the input projection of the GRU.
+        void GetNextStateFromProjection(mblas::Matrix& NextState,
+                                        const mblas::Matrix& State,
+                                        const mblas::Matrix& Embeddings) {
+          gru_.GetNextStateFromProjection(NextState, State, Embeddings);
+        }
+
+        size_t GetProjectionColumns() const {
+          return gru_.GetProjectionColumns();
+        }
+
       private:
         const Weights1& w_;
         const GRU<Weights2> gru_;
@@ -99,41 +125,67 @@ class Decoder {
       public:
         Attention(const Weights& model)
         : w_(model)
-        {
-          V_ = blaze::trans(blaze::row(w_.V_, 0));
-        }
+        {}
 
-        void Init(const mblas::Matrix& SourceContext) {
+        // The part of the attention that depends on the source only.
+        void ProjectSource(mblas::Matrix& SCU,
+                           const mblas::Matrix& SourceContext) const {
           using namespace mblas;
-          SCU_ = SourceContext * w_.U_;
-          AddBiasVector<byRow>(SCU_, w_.B_);
+          SCU = SourceContext * w_.U_;
+          AddBiasVector<byRow>(SCU, w_.B_);
+        }
+
+        // One ProjectSource result per sentence, kept by the caller.
+        void Init(const std::vector<mblas::Matrix>& SCUs) {
+          SCUs_ = &SCUs;
         }
 
         void GetAlignedSourceContext(mblas::Matrix& AlignedSourceContext,
                                      const mblas::Matrix& HiddenState,
-                                     const mblas::Matrix& SourceContext) {
+                                     const std::vector<mblas::Matrix>& SourceContexts,
+                                     const std::vector<size_t>& beamSizes) {
           using namespace mblas;
 
-          Temp2_ = HiddenState * w_.W_;
-
-          // For batching: create an A across different sentences,
-          // maybe by mapping and looping. In the and join different
-          // alignment matrices into one
-          // Or masking?
-          Temp1_ = Broadcast<Matrix>(Tanh(), SCU_, Temp2_);
+          Prod(Temp2_, HiddenState, w_.W_);
 
-          A_.resize(Temp1_.rows(), 1);
-          blaze::column(A_, 0) = Temp1_ * V_;
-          size_t words = SourceContext.rows();
-          // batch size, for batching, divide by numer of sentences
-          size_t batchSize = HiddenState.rows();
-          Reshape(A_, batchSize, words); // due to broadcasting above
-
-          float bias = w_.C_(0,0);
-          blaze::forEach(A_, [=](float x) { return x + bias; });
-
-          mblas::Softmax(A_);
-          AlignedSourceContext = A_ * SourceContext;
+          // Every sentence attends over its own source context, so the
+          // rows of its beam are handled separately. A_ is padded with
+          // zeros to the longest source sentence in the batch.
+          size_t maxWords = 0;
+          for (size_t i = 0; i < SourceContexts.size(); ++i) {
+            if (beamSizes[i] > 0) {
+              maxWords = std::max(maxWords, SourceContexts[i].rows());
+            }
+          }
+          A_.resize(HiddenState.rows(), maxWords);
+          A_ = 0.0f;
+          AlignedSourceContext.resize(HiddenState.rows(), SourceContexts[0].columns());
+
+          size_t offset = 0;
+          for (size_t i = 0; i < SourceContexts.size(); ++i) {
+            size_t batchSize = beamSizes[i];
+            if (batchSize == 0) {
+              continue;
+            }
+
+            Temp1_ = Broadcast<Matrix>(Tanh(), (*SCUs_)[i],
+                                       blaze::submatrix(Temp2_, offset, 0,
+                                                        batchSize, Temp2_.columns()));
+
+            Temp3_.resize(Temp1_.rows(), 1);
+            blaze::column(Temp3_, 0) = Temp1_ * blaze::trans(blaze::row(w_.V_, 0));
+            size_t words = SourceContexts[i].rows();
+            Reshape(Temp3_, batchSize, words); // due to broadcasting above
+
+            float bias = w_.C_(0,0);
+            blaze::forEach(Temp3_, [=](float x) { return x + bias; });
+
+            mblas::Softmax(Temp3_);
+            blaze::submatrix(A_, offset, 0, batchSize, words) = Temp3_;
+            blaze::submatrix(AlignedSourceContext, offset, 0,
+                             batchSize, AlignedSourceContext.columns()) = Temp3_ * SourceContexts[i];
+            offset += batchSize;
+          }
         }
 
         void GetAttention(mblas::Matrix& Attention) {
@@ -147,103 +199,197 @@ class Decoder {
       private:
         const Weights& w_;
 
-        mblas::Matrix SCU_;
+        const std::vector<mblas::Matrix>* SCUs_ = nullptr;
         mblas::Matrix Temp1_;
         mblas::Matrix Temp2_;
+        mblas::Matrix Temp3_;
         mblas::Matrix A_;
-        mblas::ColumnVector V_;
     };
 
     //////////////////////////////////////////////////////////////
     template <class Weights>
     class Softmax {
       public:
-        Softmax(const Weights& model)
+        // W4T is the transpose of model.W4_, used by Filter.
+        Softmax(const Weights& model, const mblas::WeightMatrix* W4T)
         : w_(model),
+          W4T_(W4T),
         filtered_(false)
         {}
 
-        void GetProbs(mblas::ArrayMatrix& Probs,
+        // Embedding holds precomputed projections from column
+        // projectedColumn on instead of embeddings, see
+        // Weights::PrecomputeEmbeddings.
+        void SetProjected(size_t projectedColumn) {
+          projected_ = true;
+          projectedColumn_ = projectedColumn;
+        }
+
+        void GetLogits(mblas::Matrix& Logits,
                   const mblas::Matrix& State,
                   const mblas::Matrix& Embedding,
-                  const mblas::Matrix& AlignedSourceContext) {
+                  const mblas::Matrix& AlignedSourceContext,
+                  const std::vector<size_t>& beamSizes) {
           using namespace mblas;
 
-          T1_ = State * w_.W1_;
-          T2_ = Embedding * w_.W2_;
-          T3_ = AlignedSourceContext * w_.W3_;
+          Prod(T1_, State, w_.W1_);
+          Prod(T3_, AlignedSourceContext, w_.W3_);
 
           AddBiasVector<byRow>(T1_, w_.B1_);
-          AddBiasVector<byRow>(T2_, w_.B2_);
           AddBiasVector<byRow>(T3_, w_.B3_);
 
-          auto t = blaze::forEach(T1_ + T2_ + T3_, Tanh());
+          if(projected_) {
+            T1_ = blaze::forEach(T1_ + T3_
+                                 + blaze::submatrix(Embedding, 0, projectedColumn_,
+                                                    Embedding.rows(), T1_.columns()),
+                                 Tanh());
+          } else {
+            Prod(T2_, Embedding, w_.W2_);
+            AddBiasVector<byRow>(T2_, w_.B2_);
+            T1_ = blaze::forEach(T1_ + T2_ + T3_, Tanh());
+          }
 
           if(!filtered_) {
-            Probs_ = t * w_.W4_;
-            AddBiasVector<byRow>(Probs_, w_.B4_);
+            Prod(Logits, T1_, w_.W4_);
+            AddBiasVector<byRow>(Logits, w_.B4_);
           } else {
-            Probs_ = t * FilteredW4_;
-            AddBiasVector<byRow>(Probs_, FilteredB4_);
+            if(w_.W4_.GetQuantized())
+              Prod(Logits, T1_, FilteredQuantizedW4_);
+            else
+              Logits = T1_ * blaze::trans(FilteredW4T_);
+            AddBiasVector<byRow>(Logits, FilteredB4_);
+
+            // the columns of other sentences of the batch
+            if(!excluded_.empty()) {
+              size_t row = 0;
+              for(size_t s = 0; s < beamSizes.size(); ++s) {
+                for(size_t end = row + beamSizes[s]; row < end; ++row) {
+                  float* logits = Logits.data(row);
+                  for(size_t column : excluded_[s])
+                    logits[column] = std::numeric_limits<float>::lowest();
+                }
+              }
+            }
           }
-          mblas::Softmax(Probs_);
-          Probs = blaze::forEach(Probs_, Log());
+        }
+
+        void Filter(const std::vector<size_t>& ids,
+                    const std::vector<std::vector<size_t>>& excluded) {
+          Filter(ids);
+          excluded_ = excluded;
         }
 
         void Filter(const std::vector<size_t>& ids) {
           filtered_ = true;
+          excluded_.clear();
           using namespace mblas;
-          FilteredW4_ = Assemble<byColumn, Matrix>(w_.W4_, ids);
-          FilteredB4_ = Assemble<byColumn, Matrix>(w_.B4_, ids);
+          if(w_.W4_.GetQuantized()) {
+            FilteredQuantizedW4_ = Int16Matrix(*w_.W4_.GetQuantized(), ids);
+          }
+          else {
+            // rows of the transpose instead of strided columns of W4_
+            const WeightMatrix& W4T = *W4T_;
+            FilteredW4T_.resize(ids.size(), W4T.columns(), false);
+            for(size_t i = 0; i < ids.size(); ++i)
+              std::copy(W4T.data(ids[i]), W4T.data(ids[i]) + W4T.columns(),
+                        FilteredW4T_.data(i));
+          }
+          FilteredB4_.resize(1, ids.size(), false);
+          const float* B4 = w_.B4_.data(0);
+          for(size_t i = 0; i < ids.size(); ++i)
+            FilteredB4_(0, i) = B4[ids[i]];
         }
 
       private:
         const Weights& w_;
+        const mblas::WeightMatrix* W4T_;
         bool filtered_;
+        bool projected_ = false;
+        size_t projectedColumn_ = 0;
 
-        mblas::Matrix FilteredW4_;
+        mblas::Matrix FilteredW4T_;
+        mblas::Int16Matrix FilteredQuantizedW4_;
         mblas::Matrix FilteredB4_;
+        std::vector<std::vector<size_t>> excluded_;
 
         mblas::Matrix T1_;
         mblas::Matrix T2_;
         mblas::Matrix T3_;
-        mblas::Matrix Probs_;
     };
 
   public:
     Decoder(const Weights& model)
-    : embeddings_(model.decEmbeddings_),
+    : model_(model),
+      embeddings_(model.decEmbeddings_, model.decEmbeddingProjections_),
       rnn1_(model.decInit_, model.decGru1_),
       rnn2_(model.decGru2_),
 	  attention_(model.decAttention_),
-      softmax_(model.decSoftmax_)
-    {}
+      softmax_(model.decSoftmax_, model.decSoftmaxW4T_.get()),
+      normalized_(false)
+    {
+      if(embeddings_.IsProjected()) {
+        softmax_.SetProjected(rnn1_.GetProjectionColumns());
+      }
+    }
 
     void MakeStep(mblas::Matrix& NextState,
                   const mblas::Matrix& State,
                   const mblas::Matrix& Embeddings,
-                  const mblas::Matrix& SourceContext) {
+                  const std::vector<mblas::Matrix>& SourceContexts,
+                  const std::vector<size_t>& beamSizes) {
       GetHiddenState(HiddenState_, State, Embeddings);
-      GetAlignedSourceContext(AlignedSourceContext_, HiddenState_, SourceContext);
+      GetAlignedSourceContext(AlignedSourceContext_, HiddenState_,
+                              SourceContexts, beamSizes);
       GetNextState(NextState, HiddenState_, AlignedSourceContext_);
-      GetProbs(NextState, Embeddings, AlignedSourceContext_);
+      GetLogits(NextState, Embeddings, AlignedSourceContext_, beamSizes);
     }
 
+    // The log probabilities of the last step, normalized on first use.
     BaseMatrix& GetProbs() {
+      if(!normalized_) {
+        size_t columns = Logits_.columns();
+        Probs_.Resize(Logits_.rows(), columns);
+        for(size_t i = 0; i < Logits_.rows(); ++i)
+          mblas::LogSoftmax(Probs_.data() + i * columns, Logits_.data(i), columns);
+        normalized_ = true;
+      }
       return Probs_;
     }
 
+    // The unnormalized scores of the last step, see mblas::LogSoftmaxTopK.
+    const mblas::Matrix& GetLogits() const {
+      return Logits_;
+    }
+
+    void ProjectSource(mblas::Matrix& SCU,
+                       const mblas::Matrix& SourceContext) const {
+      attention_.ProjectSource(SCU, SourceContext);
+    }
+
+    // SCUs are the ProjectSource results of SourceContexts; both must
+    // outlive the steps of the batch.
     void EmptyState(mblas::Matrix& State,
-                    const mblas::Matrix& SourceContext,
-                    size_t batchSize = 1) {
-      rnn1_.InitializeState(State, SourceContext, batchSize);
-      attention_.Init(SourceContext);
+                    const std::vector<mblas::Matrix>& SourceContexts,
+                    const std::vector<mblas::Matrix>& SCUs) {
+      rnn1_.InitializeState(State, SourceContexts);
+      attention_.Init(SCUs);
     }
 
+    // A zero embedding, or what it is projected to.
     void EmptyEmbedding(mblas::Matrix& Embedding,
                         size_t batchSize = 1) {
-      Embedding.resize(batchSize, embeddings_.GetCols());
-      Embedding = 0.0f;
+      if(embeddings_.IsProjected()) {
+        size_t gruColumns = rnn1_.GetProjectionColumns();
+        const auto& B2 = model_.decSoftmax_.B2_;
+        Embedding.resize(batchSize, gruColumns + B2.columns());
+        Embedding = 0.0f;
+        for(size_t i = 0; i < batchSize; ++i)
+          std::copy(B2.data(0), B2.data(0) + B2.columns(),
+                    Embedding.data(i) + gruColumns);
+      } else {
+        Embedding.resize(batchSize, embeddings_.GetCols());
+        Embedding = 0.0f;
+      }
     }
 
     void Lookup(mblas::Matrix& Embedding,
@@ -255,6 +401,11 @@ class Decoder {
       softmax_.Filter(ids);
     }
 
+    void Filter(const std::vector<size_t>& ids,
+                const std::vector<std::vector<size_t>>& excluded) {
+      softmax_.Filter(ids, excluded);
+    }
+
     void GetAttention(mblas::Matrix& attention) {
     	attention_.GetAttention(attention);
     }
@@ -272,13 +423,18 @@ class Decoder {
     void GetHiddenState(mblas::Matrix& HiddenState,
                         const mblas::Matrix& PrevState,
                         const mblas::Matrix& Embedding) {
-      rnn1_.GetNextState(HiddenState, PrevState, Embedding);
+      if(embeddings_.IsProjected())
+        rnn1_.GetNextStateFromProjection(HiddenState, PrevState, Embedding);
+      else
+        rnn1_.GetNextState(HiddenState, PrevState, Embedding);
     }
 
     void GetAlignedSourceContext(mblas::Matrix& AlignedSourceContext,
                                  const mblas::Matrix& HiddenState,
-                                 const mblas::Matrix& SourceContext) {
-    	attention_.GetAlignedSourceContext(AlignedSourceContext, HiddenState, SourceContext);
+                                 const std::vector<mblas::Matrix>& SourceContexts,
+                                 const std::vector<size_t>& beamSizes) {
+    	attention_.GetAlignedSourceContext(AlignedSourceContext, HiddenState,
+    	                                   SourceContexts, beamSizes);
     }
 
     void GetNextState(mblas::Matrix& State,
@@ -288,15 +444,20 @@ class Decoder {
     }
 
 
-    void GetProbs(const mblas::Matrix& State,
-                  const mblas::Matrix& Embedding,
-                  const mblas::Matrix& AlignedSourceContext) {
-      softmax_.GetProbs(Probs_, State, Embedding, AlignedSourceContext);
+    void GetLogits(const mblas::Matrix& State,
+                   const mblas::Matrix& Embedding,
+                   const mblas::Matrix& AlignedSourceContext,
+                   const std::vector<size_t>& beamSizes) {
+      softmax_.GetLogits(Logits_, State, Embedding, AlignedSourceContext, beamSizes);
+      normalized_ = false;
     }
 
   private:
+    const Weights& model_;
+
     mblas::Matrix HiddenState_;
     mblas::Matrix AlignedSourceContext_;
+    mblas::Matrix Logits_;
     mblas::ArrayMatrix Probs_;
 
     Embeddings<Weights::Embeddings> embeddings_;
@@ -304,6 +465,8 @@ class Decoder {
     RNNFinal<Weights::DecGRU2> rnn2_;
     Attention<Weights::DecAttention> attention_;
     Softmax<Weights::DecSoftmax> softmax_;
+
+    bool normalized_;
 };
 
 }
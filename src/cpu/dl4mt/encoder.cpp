@@ -1,29 +1,64 @@
 #include "encoder.h"
 
+#include <algorithm>
+
+#include "common/god.h"
+
 using namespace std;
 
 namespace CPU {
 
+Encoder::Encoder(const Weights& model)
+  : embeddings_(model.encEmbeddings_),
+    forwardRnn_(model.encForwardGRU_),
+    backwardRnn_(model.encBackwardGRU_),
+    backwardThread_(God::Get<bool>("parallel-encoder") ? new ThreadPool(1) : nullptr)
+{}
+
 void Encoder::GetContext(const std::vector<size_t>& words,
-				mblas::Matrix& context) {
-  std::vector<mblas::Matrix> embeddedWords;
-
-  context.resize(words.size(),
-				 forwardRnn_.GetStateLength()
-				 + backwardRnn_.GetStateLength());
-  for(auto& w : words) {
-	embeddedWords.emplace_back();
-	mblas::Matrix &embed = embeddedWords.back();
-	embeddings_.Lookup(embed, w);
+                         mblas::Matrix& context) {
+  std::vector<mblas::Matrix> contexts;
+  GetContexts({ words }, contexts);
+  context = std::move(contexts[0]);
+}
+
+void Encoder::GetContexts(const std::vector<std::vector<size_t>>& sentences,
+                          std::vector<mblas::Matrix>& contexts) {
+  size_t batch = sentences.size();
+  std::vector<size_t> lengths(batch);
+  size_t maxLength = 0;
+  for(size_t s = 0; s < batch; ++s) {
+    lengths[s] = sentences[s].size();
+    maxLength = std::max(maxLength, lengths[s]);
+  }
+
+  embeddings_.Lookup(Embedded_, sentences, maxLength);
+
+  if(backwardThread_) {
+    auto backward = backwardThread_->enqueue([&] {
+      backwardRnn_.GetStates(BackwardStates_, Embedded_, lengths, true);
+    });
+    forwardRnn_.GetStates(ForwardStates_, Embedded_, lengths, false);
+    backward.get();
+  }
+  else {
+    forwardRnn_.GetStates(ForwardStates_, Embedded_, lengths, false);
+    backwardRnn_.GetStates(BackwardStates_, Embedded_, lengths, true);
+  }
+
+  size_t forwardLength = forwardRnn_.GetStateLength();
+  size_t backwardLength = backwardRnn_.GetStateLength();
+  contexts.resize(batch);
+  for(size_t s = 0; s < batch; ++s) {
+    mblas::Matrix& context = contexts[s];
+    context.resize(lengths[s], forwardLength + backwardLength);
+    for(size_t t = 0; t < lengths[s]; ++t) {
+      const float* forward = ForwardStates_.data(t * batch + s);
+      const float* backward = BackwardStates_.data(t * batch + s);
+      std::copy(forward, forward + forwardLength, context.data(t));
+      std::copy(backward, backward + backwardLength, context.data(t) + forwardLength);
+    }
   }
-  //cerr << embeddings_.w_.E_.Debug() << endl;
-
-  forwardRnn_.GetContext(embeddedWords.cbegin(),
-						 embeddedWords.cend(),
-						 context, false);
-  backwardRnn_.GetContext(embeddedWords.crbegin(),
-						  embeddedWords.crend(),
-						  context, true);
 }
 
 }
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <memory>
+
+#include "common/threadpool.h"
 #include "../mblas/matrix.h"
 #include "../dl4mt/model.h"
 #include "../dl4mt/gru.h"
@@ -9,22 +12,32 @@ namespace CPU {
 class Encoder {
   private:
 
-	/////////////////////////////////////////////////////////////////
+    /////////////////////////////////////////////////////////////////
     template <class Weights>
     class Embeddings {
       public:
         Embeddings(const Weights& model)
         : w_(model)
         {}
-          
-        void Lookup(mblas::Matrix& Row, size_t i) {
-		  size_t len = w_.E_.columns();
-          if(i < w_.E_.rows())
-            Row = blaze::submatrix(w_.E_, i, 0, 1, len);
-          else
-            Row = blaze::submatrix(w_.E_, 1, 0, 1, len); // UNK
+
+        // Row t * batch + s is word t of sentence s, the rows past the end
+        // of a sentence repeat its last word.
+        void Lookup(mblas::Matrix& Rows,
+                    const std::vector<std::vector<size_t>>& sentences,
+                    size_t maxLength) {
+          size_t batch = sentences.size();
+          Rows.resize(maxLength * batch, w_.E_.columns());
+          for(size_t t = 0; t < maxLength; ++t) {
+            for(size_t s = 0; s < batch; ++s) {
+              const std::vector<size_t>& words = sentences[s];
+              size_t i = words.empty() ? 1 : words[std::min(t, words.size() - 1)];
+              if(i >= w_.E_.rows())
+                i = 1; // UNK
+              blaze::row(Rows, t * batch + s) = blaze::row(w_.E_, i);
+            }
+          }
         }
-      
+
         const Weights& w_;
       private:
     };
@@ -36,33 +49,35 @@ class Encoder {
         RNN(const Weights& model)
         : gru_(model) {}
         
-        void InitializeState(size_t batchSize = 1) {
-          State_.resize(batchSize, gru_.GetStateLength());
-		  State_ = 0.0f;
-        }
-        
-        void GetNextState(mblas::Matrix& NextState,
-                          const mblas::Matrix& State,
-                          const mblas::Matrix& Embd) {
-          gru_.GetNextState(NextState, State, Embd);
-        }
-        
-        template <class It>
-        void GetContext(It it, It end, 
-                        mblas::Matrix& Context, bool invert) {
-          InitializeState();
-          
-          size_t n = std::distance(it, end);
-          size_t i = 0;
-          while(it != end) {
-            GetNextState(State_, State_, *it++);
-            
-			size_t len = gru_.GetStateLength();
-            if(invert)
-              blaze::submatrix(Context, n - i - 1, len, 1, len) = State_;
-            else
-			  blaze::submatrix(Context, i, 0, 1, len) = State_;
-            ++i;
+        // Runs the GRU over a batch of sentences, Embedded as built by
+        // Embeddings::Lookup. The input projections of all steps are one
+        // matrix product, only the recurrent part goes step by step. Row
+        // t * batch + s of States is the state after word t of sentence s.
+        // Backwards, the state of a sentence stays zero until its last word.
+        void GetStates(mblas::Matrix& States,
+                       const mblas::Matrix& Embedded,
+                       const std::vector<size_t>& lengths,
+                       bool invert) {
+          size_t batch = lengths.size();
+          size_t maxLength = Embedded.rows() / batch;
+          size_t len = gru_.GetStateLength();
+
+          gru_.Project(Projected_, Embedded);
+
+          State_.resize(batch, len);
+          State_ = 0.0f;
+          States.resize(maxLength * batch, len);
+
+          for(size_t i = 0; i < maxLength; ++i) {
+            size_t t = invert ? maxLength - i - 1 : i;
+            gru_.GetNextStateFromProjection(State_, State_, Projected_, t * batch);
+
+            if(invert) {
+              for(size_t s = 0; s < batch; ++s)
+                if(t >= lengths[s])
+                  blaze::row(State_, s) = 0.0f;
+            }
+            blaze::submatrix(States, t * batch, 0, batch, len) = State_;
           }
         }
         
@@ -75,23 +90,32 @@ class Encoder {
         const GRU<Weights> gru_;
         
         mblas::Matrix State_;
+        mblas::Matrix Projected_;
     };
     
   /////////////////////////////////////////////////////////////////
   public:
-    Encoder(const Weights& model)
-    : embeddings_(model.encEmbeddings_),
-      forwardRnn_(model.encForwardGRU_),
-      backwardRnn_(model.encBackwardGRU_)
-    {}
+    Encoder(const Weights& model);
     
     void GetContext(const std::vector<size_t>& words,
                     mblas::Matrix& context);
+
+    // The source contexts of several sentences, encoded together.
+    void GetContexts(const std::vector<std::vector<size_t>>& sentences,
+                     std::vector<mblas::Matrix>& contexts);
     
   private:
     Embeddings<Weights::Embeddings> embeddings_;
     RNN<Weights::GRU> forwardRnn_;
     RNN<Weights::GRU> backwardRnn_;
+
+    // With parallel-encoder, the thread that runs the backward RNN. It lives
+    // as long as the encoder, so a batch costs no thread start.
+    std::unique_ptr<ThreadPool> backwardThread_;
+
+    mblas::Matrix Embedded_;
+    mblas::Matrix ForwardStates_;
+    mblas::Matrix BackwardStates_;
 };
 
 }
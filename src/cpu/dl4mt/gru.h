@@ -1,5 +1,7 @@
 #pragma once
 #include "../mblas/matrix.h"
+#include "../mblas/int16.h"
+#include "../mblas/elementwise.h"
 
 namespace CPU {
 
@@ -7,70 +9,51 @@ template <class Weights>
 class GRU {
   public:
     GRU(const Weights& model)
-    : w_(model) {
-      using namespace mblas;
-      WWx_ = Concat<byColumn, Matrix>(w_.W_, w_.Wx_);
-      UUx_ = Concat<byColumn, Matrix>(w_.U_, w_.Ux_);
-    }
+    : w_(model) {}
           
     void GetNextState(mblas::Matrix& NextState,
                       const mblas::Matrix& State,
                       const mblas::Matrix& Context) const {
-      RUH_ = Context * WWx_;
-      Temp_ = State * UUx_;
-      
-      // @TODO: once broadcasting is available
-      // implement this using blaze idioms
-      ElementwiseOps(NextState, State);
+      Project(RUH_, Context);
+      GetNextStateFromProjection(NextState, State, RUH_);
+    }
+
+    // The input part of a step, Context * WWx_. It does not depend on the
+    // state, so a whole sequence can be projected at once.
+    void Project(mblas::Matrix& RUH, const mblas::Matrix& Context) const {
+      mblas::Prod(RUH, Context, w_.WWx_);
+    }
+
+    // The recurrent part of a step, with the rows of RUH from firstRow on
+    // as computed by Project.
+    void GetNextStateFromProjection(mblas::Matrix& NextState,
+                                    const mblas::Matrix& State,
+                                    const mblas::Matrix& RUH,
+                                    size_t firstRow = 0) const {
+      mblas::Prod(Temp_, State, w_.UUx_);
+      ElementwiseOps(NextState, State, RUH, firstRow);
     }
           
     void ElementwiseOps(mblas::Matrix& NextState,
-                        const mblas::Matrix& State) const {
-      
-      using namespace mblas;
-      using namespace blaze;
-      
-      const size_t rowNo = State.rows();
-      const size_t colNo = State.columns();
-      NextState.resize(rowNo, colNo);
-      
-      for(int j = 0; j < rowNo; ++j) {
-        auto rowOut = row(NextState, j);
-        auto rowState = row(State, j);
-        
-        auto rowRuh = row(RUH_, j);
-        auto rowT   = row(Temp_, j);
-        
-        auto rowH   = subvector(rowRuh, 2 * colNo, colNo);
-        auto rowT2  = subvector(rowT, 2 * colNo, colNo);
-        
-        for(int i = 0; i < colNo; ++i) {
-          float ev1 = expapprox(-(rowRuh[i] + w_.B_(0, i) + rowT[i]));
-          float r = 1.0 / (1.0 + ev1);
-          
-          int k = i + colNo;
-          float ev2 = expapprox(-(rowRuh[k] + w_.B_(0, k) + rowT[k]));
-          float u = 1.0 / (1.0 + ev2);              
-    
-          float hv = rowH[i] + w_.Bx1_(0, i);
-          float t2v = rowT2[i] + w_.Bx2_(0, i);
-          hv = tanhapprox(hv + r * t2v);
-          rowOut[i] = (1.0 - u) * hv + u * rowState[i];
-        }
-      }
-      
+                        const mblas::Matrix& State,
+                        const mblas::Matrix& RUH,
+                        size_t firstRow) const {
+      mblas::GRUElementwise(NextState, State, RUH, Temp_,
+                            w_.B_, w_.Bx1_, w_.Bx2_, firstRow);
     }
     
+    size_t GetProjectionColumns() const {
+      return w_.WWx_.columns();
+    }
+
     size_t GetStateLength() const {
-      return w_.U_.rows();
+      return w_.UUx_.rows();
     }
 
     
   private:
     // Model matrices
-    const Weights& w_;    
-    mutable mblas::Matrix WWx_;
-    mutable mblas::Matrix UUx_;
+    const Weights& w_;
     
     // reused to avoid allocation
     mutable mblas::Matrix RUH_;
@@ -4,42 +4,39 @@ using namespace std;
 
 namespace CPU {
 
-Weights::Embeddings::Embeddings(const NpzConverter& model, const std::string &key)
+template <class Model>
+Weights::Embeddings::Embeddings(const Model& model, const std::string &key)
 : E_(model[key])
 {}
 
-Weights::GRU::GRU(const NpzConverter& model, const std::vector<std::string> &keys)
-: W_(model[keys.at(0)]),
+template <class Model>
+Weights::GRU::GRU(const Model& model, const std::vector<std::string> &keys)
+: WWx_(model.Concat(keys.at(0), keys.at(3))),
+  UUx_(model.Concat(keys.at(2), keys.at(5))),
   B_(model(keys.at(1), true)),
-  U_(model[keys.at(2)]),
-  Wx_(model[keys.at(3)]),
   Bx1_(model(keys.at(4), true)),
-  Bx2_(Bx1_.rows(), Bx1_.columns()),
-  Ux_(model[keys.at(5)])
-{
-    const_cast<mblas::Matrix&>(Bx2_) = 0.0f;
-}
+  Bx2_(Bx1_.rows(), Bx1_.columns(), 0.0f)
+{}
 
 //////////////////////////////////////////////////////////////////////////////
 
-Weights::DecInit::DecInit(const NpzConverter& model)
+template <class Model>
+Weights::DecInit::DecInit(const Model& model)
 : Wi_(model["ff_state_W"]),
   Bi_(model("ff_state_b", true))
 {}
 
-Weights::DecGRU2::DecGRU2(const NpzConverter& model)
-: W_(model["decoder_Wc"]),
+template <class Model>
+Weights::DecGRU2::DecGRU2(const Model& model)
+: WWx_(model.Concat("decoder_Wc", "decoder_Wcx")),
+  UUx_(model.Concat("decoder_U_nl", "decoder_Ux_nl")),
   B_(model("decoder_b_nl", true)),
-  U_(model["decoder_U_nl"]),
-  Wx_(model["decoder_Wcx"]),
   Bx2_(model("decoder_bx_nl", true)),
-  Bx1_(Bx2_.rows(), Bx2_.columns()),
-  Ux_(model["decoder_Ux_nl"])
-{
-    const_cast<mblas::Matrix&>(Bx1_) = 0.0f;
-}
+  Bx1_(Bx2_.rows(), Bx2_.columns(), 0.0f)
+{}
 
-Weights::DecAttention::DecAttention(const NpzConverter& model)
+template <class Model>
+Weights::DecAttention::DecAttention(const Model& model)
 : V_(model("decoder_U_att", true)),
 W_(model["decoder_W_comb_att"]),
 B_(model("decoder_b_att", true)),
@@ -47,7 +44,8 @@ U_(model["decoder_Wc_att"]),
 C_(model["decoder_c_tt"]) // scalar?
 {}
 
-Weights::DecSoftmax::DecSoftmax(const NpzConverter& model)
+template <class Model>
+Weights::DecSoftmax::DecSoftmax(const Model& model)
 : W1_(model["ff_logit_lstm_W"]),
   B1_(model("ff_logit_lstm_b", true)),
   W2_(model["ff_logit_prev_W"]),
@@ -60,7 +58,8 @@ Weights::DecSoftmax::DecSoftmax(const NpzConverter& model)
 
 //////////////////////////////////////////////////////////////////////////////
 
-Weights::Weights(const NpzConverter& model, size_t)
+template <class Model>
+Weights::Weights(const Model& model, size_t)
 : encEmbeddings_(model, "Wemb"),
 encForwardGRU_(model, {"encoder_W", "encoder_b", "encoder_U", "encoder_Wx", "encoder_bx", "encoder_Ux"}),
 encBackwardGRU_(model, {"encoder_r_W", "encoder_r_b", "encoder_r_U", "encoder_r_Wx", "encoder_r_bx", "encoder_r_Ux"}),
@@ -74,5 +73,56 @@ decSoftmax_(model)
 	//cerr << *this << endl;
 }
 
+void Weights::Quantize() {
+  decGru1_.WWx_.Quantize();
+  decGru1_.UUx_.Quantize();
+  decGru2_.WWx_.Quantize();
+  decGru2_.UUx_.Quantize();
+  decAttention_.W_.Quantize();
+  decSoftmax_.W1_.Quantize();
+  decSoftmax_.W2_.Quantize();
+  decSoftmax_.W3_.Quantize();
+  decSoftmax_.W4_.Quantize();
+}
+
+void Weights::PrecomputeEmbeddings() {
+  using namespace mblas;
+  const WeightMatrix& E = decEmbeddings_.E_;
+  size_t gruColumns = decGru1_.WWx_.columns();
+  size_t softmaxColumns = decSoftmax_.W2_.columns();
+
+  decEmbeddingProjections_.resize(E.rows(), gruColumns + softmaxColumns);
+  blaze::submatrix(decEmbeddingProjections_, 0, 0, E.rows(), gruColumns)
+    = E * decGru1_.WWx_;
+  blaze::submatrix(decEmbeddingProjections_, 0, gruColumns, E.rows(), softmaxColumns)
+    = E * decSoftmax_.W2_;
+  const float* bias = decSoftmax_.B2_.data(0);
+  for(size_t i = 0; i < E.rows(); ++i) {
+    float* row = decEmbeddingProjections_.data(i) + gruColumns;
+    for(size_t j = 0; j < softmaxColumns; ++j)
+      row[j] += bias[j];
+  }
+}
+
+bool Weights::TransposeOutputLayer(const BinaryModel* model) {
+  if(model) {
+    mblas::WeightMatrix W4T = model->Transposed("ff_logit_W");
+    if(W4T.rows() > 0) {
+      decSoftmaxW4T_.reset(new mblas::WeightMatrix(W4T));
+      return true;
+    }
+  }
+  decSoftmaxW4T_.reset(new mblas::WeightMatrix(blaze::trans(decSoftmax_.W4_)));
+  return false;
+}
+
+void Weights::TransposeOutputLayer(const BinaryModelWriter& writer) {
+  writer.Transposed("ff_logit_W");
+}
+
+template Weights::Weights(const NpzConverter&, size_t);
+template Weights::Weights(const BinaryModel&, size_t);
+template Weights::Weights(const BinaryModelWriter&, size_t);
+
 }
 
@@ -2,9 +2,11 @@
 
 #include <iostream>
 #include <map>
+#include <memory>
 #include <string>
 
 #include "../npz_converter.h"
+#include "../binary_model.h"
 
 #include "../mblas/matrix.h"
 
@@ -15,65 +17,68 @@ struct Weights {
   //////////////////////////////////////////////////////////////////////////////
 
   struct Embeddings {
-    Embeddings(const NpzConverter& model, const std::string &key);
+    template <class Model>
+    Embeddings(const Model& model, const std::string &key);
 
-    const mblas::Matrix E_;
+    const mblas::WeightMatrix E_;
   };
 
   struct GRU {
-	GRU(const NpzConverter& model, const std::vector<std::string> &keys);
-
-    const mblas::Matrix W_;
-    const mblas::Matrix B_;
-    const mblas::Matrix U_;
-    const mblas::Matrix Wx_;
-    const mblas::Matrix Bx1_;
-    const mblas::Matrix Bx2_;
-    const mblas::Matrix Ux_;
+    template <class Model>
+    GRU(const Model& model, const std::vector<std::string> &keys);
+
+    // [W Wx] and [U Ux], so gates and candidate need one product each
+    const mblas::WeightMatrix WWx_;
+    const mblas::WeightMatrix UUx_;
+    const mblas::WeightMatrix B_;
+    const mblas::WeightMatrix Bx1_;
+    const mblas::WeightMatrix Bx2_;
   };
 
   //////////////////////////////////////////////////////////////////////////////
 
   struct DecInit {
-    DecInit(const NpzConverter& model);
+    template <class Model>
+    DecInit(const Model& model);
 
-    const mblas::Matrix Wi_;
-    const mblas::Matrix Bi_;
+    const mblas::WeightMatrix Wi_;
+    const mblas::WeightMatrix Bi_;
   };
 
   struct DecGRU2 {
-    DecGRU2(const NpzConverter& model);
-
-    const mblas::Matrix W_;
-    const mblas::Matrix B_;
-    const mblas::Matrix U_;
-    const mblas::Matrix Wx_;
-    const mblas::Matrix Bx2_;
-    const mblas::Matrix Bx1_;
-    const mblas::Matrix Ux_;
+    template <class Model>
+    DecGRU2(const Model& model);
+
+    const mblas::WeightMatrix WWx_;
+    const mblas::WeightMatrix UUx_;
+    const mblas::WeightMatrix B_;
+    const mblas::WeightMatrix Bx2_;
+    const mblas::WeightMatrix Bx1_;
   };
 
   struct DecAttention {
-    DecAttention(const NpzConverter& model);
-
-    const mblas::Matrix V_;
-    const mblas::Matrix W_;
-    const mblas::Matrix B_;
-    const mblas::Matrix U_;
-    const mblas::Matrix C_;
+    template <class Model>
+    DecAttention(const Model& model);
+
+    const mblas::WeightMatrix V_;
+    const mblas::WeightMatrix W_;
+    const mblas::WeightMatrix B_;
+    const mblas::WeightMatrix U_;
+    const mblas::WeightMatrix C_;
   };
 
   struct DecSoftmax {
-    DecSoftmax(const NpzConverter& model);
-
-    const mblas::Matrix W1_;
-    const mblas::Matrix B1_;
-    const mblas::Matrix W2_;
-    const mblas::Matrix B2_;
-    const mblas::Matrix W3_;
-    const mblas::Matrix B3_;
-    const mblas::Matrix W4_;
-    const mblas::Matrix B4_;
+    template <class Model>
+    DecSoftmax(const Model& model);
+
+    const mblas::WeightMatrix W1_;
+    const mblas::WeightMatrix B1_;
+    const mblas::WeightMatrix W2_;
+    const mblas::WeightMatrix B2_;
+    const mblas::WeightMatrix W3_;
+    const mblas::WeightMatrix B3_;
+    const mblas::WeightMatrix W4_;
+    const mblas::WeightMatrix B4_;
   };
 
   //////////////////////////////////////////////////////////////////////////////
@@ -82,12 +87,29 @@ struct Weights {
   : Weights(NpzConverter(npzFile), device)
   {}
 
-  Weights(const NpzConverter& model, size_t device = 0);
+  // Model is NpzConverter, BinaryModel or BinaryModelWriter.
+  template <class Model>
+  Weights(const Model& model, size_t device = 0);
 
   size_t GetDevice() {
     return 0;
   }
 
+  // Switches the products of the decoder steps to int16, see mblas::Prod.
+  void Quantize();
+
+  // Fills decEmbeddingProjections_. Costs a vocabulary-sized GEMM once and
+  // (3 * state + softmax) floats per target word.
+  void PrecomputeEmbeddings();
+
+  // Fills decSoftmaxW4T_ for filtered output layers. Views the transpose
+  // npz2bin stores in binary models if model has one, returns false if it
+  // had to compute a private copy from W4_ instead.
+  bool TransposeOutputLayer(const BinaryModel* model);
+
+  // Adds the transpose of W4_ to the converted model.
+  void TransposeOutputLayer(const BinaryModelWriter& writer);
+
   const Embeddings encEmbeddings_;
   const Embeddings decEmbeddings_;
   const GRU encForwardGRU_;
@@ -97,6 +119,16 @@ struct Weights {
   const DecGRU2 decGru2_;
   const DecAttention decAttention_;
   const DecSoftmax decSoftmax_;
+
+  // Row w is [E_w * decGru1_.WWx_, E_w * decSoftmax_.W2_ + B2_], the parts
+  // of a decoder step that depend on the previous word only. Empty unless
+  // PrecomputeEmbeddings has been called.
+  mblas::Matrix decEmbeddingProjections_;
+
+  // Row w is column w of decSoftmax_.W4_, so the output layer of a filtered
+  // target vocabulary is gathered from contiguous rows. Null unless
+  // TransposeOutputLayer has been called.
+  std::unique_ptr<const mblas::WeightMatrix> decSoftmaxW4T_;
 };
 
 inline std::ostream& operator<<(std::ostream &out, const Weights::Embeddings &obj)
@@ -107,25 +139,21 @@ inline std::ostream& operator<<(std::ostream &out, const Weights::Embeddings &ob
 
 inline std::ostream& operator<<(std::ostream &out, const Weights::GRU &obj)
 {
-	out << "W_ \t" << obj.W_ << std::endl;
+	out << "WWx_ \t" << obj.WWx_ << std::endl;
+	out << "UUx_ \t" << obj.UUx_ << std::endl;
 	out << "B_ \t" << obj.B_ << std::endl;
-	out << "U_ \t" << obj.U_ << std::endl;
-	out << "Wx_ \t" << obj.Wx_ << std::endl;
 	out << "Bx1_ \t" << obj.Bx1_ << std::endl;
-	out << "Bx2_ \t" << obj.Bx2_ << std::endl;
-	out << "Ux_ \t" << obj.Ux_;
+	out << "Bx2_ \t" << obj.Bx2_;
 	return out;
 }
 
 inline std::ostream& operator<<(std::ostream &out, const Weights::DecGRU2 &obj)
 {
-	out << "W_ \t" << obj.W_ << std::endl;
+	out << "WWx_ \t" << obj.WWx_ << std::endl;
+	out << "UUx_ \t" << obj.UUx_ << std::endl;
 	out << "B_ \t" << obj.B_ << std::endl;
-	out << "U_ \t" << obj.U_ << std::endl;
-	out << "Wx_ \t" << obj.Wx_ << std::endl;
 	out << "Bx1_ \t" << obj.Bx1_ << std::endl;
-	out << "Bx2_ \t" << obj.Bx2_ << std::endl;
-	out << "Ux_ \t" << obj.Ux_;
+	out << "Bx2_ \t" << obj.Bx2_;
 	return out;
 }
 
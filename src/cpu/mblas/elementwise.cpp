@@ -0,0 +1,356 @@
+#include "elementwise.h"
+
+#include <cmath>
+#include <immintrin.h>
+#include <limits>
+
+namespace CPU {
+
+namespace mblas {
+
+namespace {
+
+// One row of GRUElementwise, n = state size.
+typedef void (*GRUKernel)(float* out, const float* state,
+                          const float* ruh, const float* temp,
+                          const float* b, const float* bx1, const float* bx2,
+                          size_t n);
+
+// Element i of a row, also used for the remainder of the SIMD kernels.
+inline void GRUElement(size_t i, float* out, const float* state,
+                       const float* ruh, const float* temp,
+                       const float* b, const float* bx1, const float* bx2,
+                       size_t n) {
+  float r = 1.0f / (1.0f + expapprox(-(ruh[i] + b[i] + temp[i])));
+  size_t k = i + n;
+  float u = 1.0f / (1.0f + expapprox(-(ruh[k] + b[k] + temp[k])));
+  size_t l = i + 2 * n;
+  float h = tanhapprox(ruh[l] + bx1[i] + r * (temp[l] + bx2[i]));
+  out[i] = (1.0f - u) * h + u * state[i];
+}
+
+void GRUScalar(float* out, const float* state,
+               const float* ruh, const float* temp,
+               const float* b, const float* bx1, const float* bx2,
+               size_t n) {
+  for(size_t i = 0; i < n; ++i)
+    GRUElement(i, out, state, ruh, temp, b, bx1, bx2, n);
+}
+
+// The vector versions of expapprox and tanhapprox below follow the scalar
+// ones operation by operation.
+
+__attribute__((target("avx")))
+inline __m256 ExpAvx(__m256 x) {
+  __m256 v = _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(12102203.1615614f), x),
+                           _mm256_set1_ps(1065353216.f));
+  v = _mm256_min_ps(v, _mm256_set1_ps(exp_cst1));
+  v = _mm256_max_ps(v, _mm256_set1_ps(exp_cst2));
+  __m256 bits = _mm256_castsi256_ps(_mm256_cvttps_epi32(v));
+  __m256 xu = _mm256_and_ps(bits, _mm256_castsi256_ps(_mm256_set1_epi32(0x7F800000)));
+  __m256 b = _mm256_or_ps(_mm256_and_ps(bits, _mm256_castsi256_ps(_mm256_set1_epi32(0x7FFFFF))),
+                          _mm256_castsi256_ps(_mm256_set1_epi32(0x3F800000)));
+  __m256 p = _mm256_set1_ps(1.3671023382430374383648148e-2f);
+  p = _mm256_add_ps(_mm256_set1_ps(-2.88093587581985443087955e-3f), _mm256_mul_ps(b, p));
+  p = _mm256_add_ps(_mm256_set1_ps(0.168143436463395944830000f), _mm256_mul_ps(b, p));
+  p = _mm256_add_ps(_mm256_set1_ps(0.310670891004095530771135f), _mm256_mul_ps(b, p));
+  p = _mm256_add_ps(_mm256_set1_ps(0.510397365625862338668154f), _mm256_mul_ps(b, p));
+  return _mm256_mul_ps(xu, p);
+}
+
+__attribute__((target("avx")))
+inline __m256 LogitAvx(__m256 x) {
+  __m256 one = _mm256_set1_ps(1.0f);
+  __m256 e = ExpAvx(_mm256_sub_ps(_mm256_setzero_ps(), x));
+  return _mm256_div_ps(one, _mm256_add_ps(one, e));
+}
+
+__attribute__((target("avx")))
+inline __m256 TanhAvx(__m256 x) {
+  x = _mm256_max_ps(_mm256_min_ps(x, _mm256_set1_ps(4.97f)), _mm256_set1_ps(-4.97f));
+  __m256 x2 = _mm256_mul_ps(x, x);
+  __m256 a = _mm256_add_ps(_mm256_set1_ps(378.0f), x2);
+  a = _mm256_add_ps(_mm256_set1_ps(17325.0f), _mm256_mul_ps(x2, a));
+  a = _mm256_add_ps(_mm256_set1_ps(135135.0f), _mm256_mul_ps(x2, a));
+  a = _mm256_mul_ps(x, a);
+  __m256 b = _mm256_mul_ps(x2, _mm256_set1_ps(28.0f));
+  b = _mm256_add_ps(_mm256_set1_ps(3150.0f), b);
+  b = _mm256_add_ps(_mm256_set1_ps(62370.0f), _mm256_mul_ps(x2, b));
+  b = _mm256_add_ps(_mm256_set1_ps(135135.0f), _mm256_mul_ps(x2, b));
+  return _mm256_div_ps(a, b);
+}
+
+__attribute__((target("avx")))
+void GRUAvx(float* out, const float* state,
+            const float* ruh, const float* temp,
+            const float* b, const float* bx1, const float* bx2,
+            size_t n) {
+  const size_t k = n, l = 2 * n;
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8) {
+    __m256 r = LogitAvx(_mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(ruh + i),
+                                                    _mm256_loadu_ps(b + i)),
+                                      _mm256_loadu_ps(temp + i)));
+    __m256 u = LogitAvx(_mm256_add_ps(_mm256_add_ps(_mm256_loadu_ps(ruh + k + i),
+                                                    _mm256_loadu_ps(b + k + i)),
+                                      _mm256_loadu_ps(temp + k + i)));
+    __m256 hv = _mm256_add_ps(_mm256_loadu_ps(ruh + l + i), _mm256_loadu_ps(bx1 + i));
+    __m256 tv = _mm256_add_ps(_mm256_loadu_ps(temp + l + i), _mm256_loadu_ps(bx2 + i));
+    __m256 h = TanhAvx(_mm256_add_ps(hv, _mm256_mul_ps(r, tv)));
+    __m256 o = _mm256_add_ps(_mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(1.0f), u), h),
+                             _mm256_mul_ps(u, _mm256_loadu_ps(state + i)));
+    _mm256_storeu_ps(out + i, o);
+  }
+  for(; i < n; ++i)
+    GRUElement(i, out, state, ruh, temp, b, bx1, bx2, n);
+}
+
+__attribute__((target("avx512f")))
+inline __m512 ExpAvx512(__m512 x) {
+  __m512 v = _mm512_add_ps(_mm512_mul_ps(_mm512_set1_ps(12102203.1615614f), x),
+                           _mm512_set1_ps(1065353216.f));
+  v = _mm512_min_ps(v, _mm512_set1_ps(exp_cst1));
+  v = _mm512_max_ps(v, _mm512_set1_ps(exp_cst2));
+  __m512i bits = _mm512_cvttps_epi32(v);
+  __m512 xu = _mm512_castsi512_ps(_mm512_and_si512(bits, _mm512_set1_epi32(0x7F800000)));
+  __m512 b = _mm512_castsi512_ps(_mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x7FFFFF)),
+                                                 _mm512_set1_epi32(0x3F800000)));
+  __m512 p = _mm512_set1_ps(1.3671023382430374383648148e-2f);
+  p = _mm512_add_ps(_mm512_set1_ps(-2.88093587581985443087955e-3f), _mm512_mul_ps(b, p));
+  p = _mm512_add_ps(_mm512_set1_ps(0.168143436463395944830000f), _mm512_mul_ps(b, p));
+  p = _mm512_add_ps(_mm512_set1_ps(0.310670891004095530771135f), _mm512_mul_ps(b, p));
+  p = _mm512_add_ps(_mm512_set1_ps(0.510397365625862338668154f), _mm512_mul_ps(b, p));
+  return _mm512_mul_ps(xu, p);
+}
+
+__attribute__((target("avx512f")))
+inline __m512 LogitAvx512(__m512 x) {
+  __m512 one = _mm512_set1_ps(1.0f);
+  __m512 e = ExpAvx512(_mm512_sub_ps(_mm512_setzero_ps(), x));
+  return _mm512_div_ps(one, _mm512_add_ps(one, e));
+}
+
+__attribute__((target("avx512f")))
+inline __m512 TanhAvx512(__m512 x) {
+  x = _mm512_max_ps(_mm512_min_ps(x, _mm512_set1_ps(4.97f)), _mm512_set1_ps(-4.97f));
+  __m512 x2 = _mm512_mul_ps(x, x);
+  __m512 a = _mm512_add_ps(_mm512_set1_ps(378.0f), x2);
+  a = _mm512_add_ps(_mm512_set1_ps(17325.0f), _mm512_mul_ps(x2, a));
+  a = _mm512_add_ps(_mm512_set1_ps(135135.0f), _mm512_mul_ps(x2, a));
+  a = _mm512_mul_ps(x, a);
+  __m512 b = _mm512_mul_ps(x2, _mm512_set1_ps(28.0f));
+  b = _mm512_add_ps(_mm512_set1_ps(3150.0f), b);
+  b = _mm512_add_ps(_mm512_set1_ps(62370.0f), _mm512_mul_ps(x2, b));
+  b = _mm512_add_ps(_mm512_set1_ps(135135.0f), _mm512_mul_ps(x2, b));
+  return _mm512_div_ps(a, b);
+}
+
+__attribute__((target("avx512f")))
+void GRUAvx512(float* out, const float* state,
+               const float* ruh, const float* temp,
+               const float* b, const float* bx1, const float* bx2,
+               size_t n) {
+  const size_t k = n, l = 2 * n;
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16) {
+    __m512 r = LogitAvx512(_mm512_add_ps(_mm512_add_ps(_mm512_loadu_ps(ruh + i),
+                                                       _mm512_loadu_ps(b + i)),
+                                         _mm512_loadu_ps(temp + i)));
+    __m512 u = LogitAvx512(_mm512_add_ps(_mm512_add_ps(_mm512_loadu_ps(ruh + k + i),
+                                                       _mm512_loadu_ps(b + k + i)),
+                                         _mm512_loadu_ps(temp + k + i)));
+    __m512 hv = _mm512_add_ps(_mm512_loadu_ps(ruh + l + i), _mm512_loadu_ps(bx1 + i));
+    __m512 tv = _mm512_add_ps(_mm512_loadu_ps(temp + l + i), _mm512_loadu_ps(bx2 + i));
+    __m512 h = TanhAvx512(_mm512_add_ps(hv, _mm512_mul_ps(r, tv)));
+    __m512 o = _mm512_add_ps(_mm512_mul_ps(_mm512_sub_ps(_mm512_set1_ps(1.0f), u), h),
+                             _mm512_mul_ps(u, _mm512_loadu_ps(state + i)));
+    _mm512_storeu_ps(out + i, o);
+  }
+  for(; i < n; ++i)
+    GRUElement(i, out, state, ruh, temp, b, bx1, bx2, n);
+}
+
+// The best candidates seen so far, kept sorted. Ties keep the column
+// that was added first.
+class BestK {
+  public:
+    BestK(std::vector<Candidate>& best, size_t k, size_t skip)
+      : best_(best), k_(k), skip_(skip),
+        threshold_(std::numeric_limits<float>::lowest()) {
+      best_.clear();
+      best_.reserve(k + 1);
+    }
+
+    // Scores that are not larger than this cannot become candidates.
+    float Threshold() const {
+      return threshold_;
+    }
+
+    void Add(float score, size_t column) {
+      if(column == skip_)
+        return;
+      auto it = best_.end();
+      while(it != best_.begin() && (it - 1)->score < score)
+        --it;
+      best_.insert(it, Candidate{score, column});
+      if(best_.size() > k_)
+        best_.pop_back();
+      if(best_.size() == k_)
+        threshold_ = best_.back().score;
+    }
+
+  private:
+    std::vector<Candidate>& best_;
+    size_t k_;
+    size_t skip_;
+    float threshold_;
+};
+
+// Adds the entries in[begin:n] to top. Vectors of entries are compared
+// against the threshold at once, which almost always rejects all of them.
+typedef void (*ScanKernel)(BestK& top, const float* in, size_t begin, size_t n);
+
+// sum(exp(in[0:n] - max))
+typedef float (*SumExpKernel)(const float* in, size_t n, float max);
+
+void ScanScalar(BestK& top, const float* in, size_t begin, size_t n) {
+  for(size_t i = begin; i < n; ++i)
+    if(in[i] > top.Threshold())
+      top.Add(in[i], i);
+}
+
+float SumExpScalar(const float* in, size_t n, float max) {
+  float sum = 0.0f;
+  for(size_t i = 0; i < n; ++i)
+    sum += expapprox(in[i] - max);
+  return sum;
+}
+
+__attribute__((target("avx")))
+void ScanAvx(BestK& top, const float* in, size_t begin, size_t n) {
+  size_t i = begin;
+  for(; i + 8 <= n; i += 8) {
+    __m256 x = _mm256_loadu_ps(in + i);
+    int mask = _mm256_movemask_ps(_mm256_cmp_ps(x, _mm256_set1_ps(top.Threshold()),
+                                                _CMP_GT_OQ));
+    for(; mask; mask &= mask - 1) {
+      size_t j = i + __builtin_ctz(mask);
+      if(in[j] > top.Threshold())
+        top.Add(in[j], j);
+    }
+  }
+  ScanScalar(top, in, i, n);
+}
+
+__attribute__((target("avx")))
+float SumExpAvx(const float* in, size_t n, float max) {
+  __m256 m = _mm256_set1_ps(max);
+  __m256 sum = _mm256_setzero_ps();
+  size_t i = 0;
+  for(; i + 8 <= n; i += 8)
+    sum = _mm256_add_ps(sum, ExpAvx(_mm256_sub_ps(_mm256_loadu_ps(in + i), m)));
+  float lanes[8];
+  _mm256_storeu_ps(lanes, sum);
+  float total = 0.0f;
+  for(float lane : lanes)
+    total += lane;
+  return total + SumExpScalar(in + i, n - i, max);
+}
+
+__attribute__((target("avx512f")))
+void ScanAvx512(BestK& top, const float* in, size_t begin, size_t n) {
+  size_t i = begin;
+  for(; i + 16 <= n; i += 16) {
+    __m512 x = _mm512_loadu_ps(in + i);
+    unsigned mask = _mm512_cmp_ps_mask(x, _mm512_set1_ps(top.Threshold()), _CMP_GT_OQ);
+    for(; mask; mask &= mask - 1) {
+      size_t j = i + __builtin_ctz(mask);
+      if(in[j] > top.Threshold())
+        top.Add(in[j], j);
+    }
+  }
+  ScanScalar(top, in, i, n);
+}
+
+__attribute__((target("avx512f")))
+float SumExpAvx512(const float* in, size_t n, float max) {
+  __m512 m = _mm512_set1_ps(max);
+  __m512 sum = _mm512_setzero_ps();
+  size_t i = 0;
+  for(; i + 16 <= n; i += 16)
+    sum = _mm512_add_ps(sum, ExpAvx512(_mm512_sub_ps(_mm512_loadu_ps(in + i), m)));
+  return _mm512_reduce_add_ps(sum) + SumExpScalar(in + i, n - i, max);
+}
+
+template <class Kernel>
+Kernel SelectKernel(Kernel avx512, Kernel avx, Kernel scalar) {
+  if(__builtin_cpu_supports("avx512f"))
+    return avx512;
+  if(__builtin_cpu_supports("avx"))
+    return avx;
+  return scalar;
+}
+
+ScanKernel Scan() {
+  static const ScanKernel scan = SelectKernel(ScanAvx512, ScanAvx, ScanScalar);
+  return scan;
+}
+
+float LogSumExp(const float* in, size_t n, float max) {
+  static const SumExpKernel sumExp = SelectKernel(SumExpAvx512, SumExpAvx, SumExpScalar);
+  return max + std::log(sumExp(in, n, max));
+}
+
+}
+
+void GRUElementwise(Matrix& NextState, const Matrix& State,
+                    const Matrix& RUH, const Matrix& Temp,
+                    const WeightMatrix& B, const WeightMatrix& Bx1,
+                    const WeightMatrix& Bx2, size_t firstRow) {
+  static const GRUKernel kernel = SelectKernel(GRUAvx512, GRUAvx, GRUScalar);
+
+  const size_t rows = State.rows();
+  const size_t n = State.columns();
+  NextState.resize(rows, n);
+
+  for(size_t j = 0; j < rows; ++j) {
+    kernel(NextState.data(j), State.data(j), RUH.data(firstRow + j), Temp.data(j),
+           B.data(0), Bx1.data(0), Bx2.data(0), n);
+  }
+}
+
+void LogSoftmax(float* out, const float* in, size_t n) {
+  if(n == 0)
+    return;
+  float max = in[0];
+  for(size_t i = 1; i < n; ++i)
+    max = std::max(max, in[i]);
+  float norm = LogSumExp(in, n, max);
+  for(size_t i = 0; i < n; ++i)
+    out[i] = in[i] - norm;
+}
+
+void TopK(std::vector<Candidate>& best, const float* in, size_t n, size_t k) {
+  BestK top(best, k, n);
+  if(k > 0)
+    Scan()(top, in, 0, n);
+}
+
+void LogSoftmaxTopK(std::vector<Candidate>& best, const float* in, size_t n,
+                    size_t k, size_t skip) {
+  BestK top(best, k, skip);
+  if(n == 0)
+    return;
+  if(k > 0)
+    Scan()(top, in, 0, n);
+
+  float max = best.empty() ? in[0] : best[0].score;
+  if(skip < n)
+    max = std::max(max, in[skip]);
+  float norm = LogSumExp(in, n, max);
+  for(auto& candidate : best)
+    candidate.score -= norm;
+}
+
+}
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <vector>
+
+#include "matrix.h"
+
+namespace CPU {
+
+namespace mblas {
+
+// The gates of a GRU step after its two matrix products, in a single pass
+// over every row:
+//
+//   r = logit(RUH[0:n] + B[0:n] + Temp[0:n])
+//   u = logit(RUH[n:2n] + B[n:2n] + Temp[n:2n])
+//   h = tanh(RUH[2n:3n] + Bx1 + r * (Temp[2n:3n] + Bx2))
+//   NextState = (1 - u) * h + u * State
+//
+// with n = State.columns(). Row j of State uses row firstRow + j of RUH,
+// so the rows of a step can be read from a larger matrix in place. Uses
+// AVX-512 or AVX if the CPU supports them.
+void GRUElementwise(Matrix& NextState, const Matrix& State,
+                    const Matrix& RUH, const Matrix& Temp,
+                    const WeightMatrix& B, const WeightMatrix& Bx1,
+                    const WeightMatrix& Bx2, size_t firstRow = 0);
+
+// out[0:n] = log(softmax(in[0:n])). in and out may be the same.
+void LogSoftmax(float* out, const float* in, size_t n);
+
+// A column of a row of scores.
+struct Candidate {
+  float score;
+  size_t column;
+};
+
+// The k largest entries of in[0:n], best first, in a single read-only
+// pass. Ties keep the smaller column.
+void TopK(std::vector<Candidate>& best, const float* in, size_t n, size_t k);
+
+// The k largest entries of log(softmax(in[0:n])), best first, without
+// computing the others: one pass finds them and the maximum, a second one
+// sums the exponentials. Column skip is left out of the candidates, but
+// not of the normalization.
+void LogSoftmaxTopK(std::vector<Candidate>& best, const float* in, size_t n,
+                    size_t k, size_t skip);
+
+}
+}
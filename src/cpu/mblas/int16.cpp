@@ -0,0 +1,228 @@
+#include "int16.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <immintrin.h>
+
+namespace CPU {
+
+namespace mblas {
+
+namespace {
+
+// int16 values per AVX-512 register; rows are padded to this for all kernels
+const size_t Width = 32;
+
+// Columns are multiplied in groups of four, see Dot4.
+const size_t Group = 4;
+
+size_t RoundUp(size_t n, size_t multiple) {
+  return (n + multiple - 1) / multiple * multiple;
+}
+
+// The largest absolute value quantized numbers get. A dot product of n
+// values is then bounded by n * multiplier^2, which fits into an int32.
+// This costs precision for long rows: at n = 1024 the multiplier is 1448,
+// so values keep only about 11 bits, sign included, relative to the
+// largest one of their row or column.
+float Multiplier(size_t n) {
+  return std::min(32767.0, std::floor(std::sqrt(2147483647.0 / std::max<size_t>(n, 1))));
+}
+
+// Quantizes n floats and returns the factor that turns the integers back
+// into floats.
+float Quantize(const float* in, size_t n, float multiplier, int16_t* out) {
+  float maxAbs = 0.0f;
+  for(size_t i = 0; i < n; ++i)
+    maxAbs = std::max(maxAbs, std::abs(in[i]));
+
+  if(maxAbs == 0.0f) {
+    std::fill(out, out + n, 0);
+    return 0.0f;
+  }
+
+  float scale = multiplier / maxAbs;
+  for(size_t i = 0; i < n; ++i)
+    out[i] = (int16_t)std::lrint(in[i] * scale);
+  return maxAbs / multiplier;
+}
+
+// Dot products of a with the four rows b, b + stride, ... over n values,
+// n a multiple of Width.
+typedef void (*Dot4Kernel)(const int16_t* a, const int16_t* b,
+                           size_t stride, size_t n, int32_t* out);
+
+void Dot4Sse(const int16_t* a, const int16_t* b,
+             size_t stride, size_t n, int32_t* out) {
+  __m128i s0 = _mm_setzero_si128(), s1 = s0, s2 = s0, s3 = s0;
+  for(size_t k = 0; k < n; k += 8) {
+    __m128i x = _mm_loadu_si128((const __m128i*)(a + k));
+    s0 = _mm_add_epi32(s0, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i*)(b + k))));
+    s1 = _mm_add_epi32(s1, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i*)(b + stride + k))));
+    s2 = _mm_add_epi32(s2, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i*)(b + 2 * stride + k))));
+    s3 = _mm_add_epi32(s3, _mm_madd_epi16(x, _mm_loadu_si128((const __m128i*)(b + 3 * stride + k))));
+  }
+  __m128i s = _mm_hadd_epi32(_mm_hadd_epi32(s0, s1), _mm_hadd_epi32(s2, s3));
+  _mm_storeu_si128((__m128i*)out, s);
+}
+
+__attribute__((target("avx2")))
+void Dot4Avx2(const int16_t* a, const int16_t* b,
+              size_t stride, size_t n, int32_t* out) {
+  __m256i s0 = _mm256_setzero_si256(), s1 = s0, s2 = s0, s3 = s0;
+  for(size_t k = 0; k < n; k += 16) {
+    __m256i x = _mm256_loadu_si256((const __m256i*)(a + k));
+    s0 = _mm256_add_epi32(s0, _mm256_madd_epi16(x, _mm256_loadu_si256((const __m256i*)(b + k))));
+    s1 = _mm256_add_epi32(s1, _mm256_madd_epi16(x, _mm256_loadu_si256((const __m256i*)(b + stride + k))));
+    s2 = _mm256_add_epi32(s2, _mm256_madd_epi16(x, _mm256_loadu_si256((const __m256i*)(b + 2 * stride + k))));
+    s3 = _mm256_add_epi32(s3, _mm256_madd_epi16(x, _mm256_loadu_si256((const __m256i*)(b + 3 * stride + k))));
+  }
+  __m256i s = _mm256_hadd_epi32(_mm256_hadd_epi32(s0, s1), _mm256_hadd_epi32(s2, s3));
+  _mm_storeu_si128((__m128i*)out, _mm_add_epi32(_mm256_castsi256_si128(s),
+                                                _mm256_extracti128_si256(s, 1)));
+}
+
+__attribute__((target("avx512bw")))
+void Dot4Avx512(const int16_t* a, const int16_t* b,
+                size_t stride, size_t n, int32_t* out) {
+  __m512i s0 = _mm512_setzero_si512(), s1 = s0, s2 = s0, s3 = s0;
+  for(size_t k = 0; k < n; k += 32) {
+    __m512i x = _mm512_loadu_si512(a + k);
+    s0 = _mm512_add_epi32(s0, _mm512_madd_epi16(x, _mm512_loadu_si512(b + k)));
+    s1 = _mm512_add_epi32(s1, _mm512_madd_epi16(x, _mm512_loadu_si512(b + stride + k)));
+    s2 = _mm512_add_epi32(s2, _mm512_madd_epi16(x, _mm512_loadu_si512(b + 2 * stride + k)));
+    s3 = _mm512_add_epi32(s3, _mm512_madd_epi16(x, _mm512_loadu_si512(b + 3 * stride + k)));
+  }
+  out[0] = _mm512_reduce_add_epi32(s0);
+  out[1] = _mm512_reduce_add_epi32(s1);
+  out[2] = _mm512_reduce_add_epi32(s2);
+  out[3] = _mm512_reduce_add_epi32(s3);
+}
+
+struct Kernel {
+  const char* name;
+  Dot4Kernel dot4;
+};
+
+// Widest first.
+const Kernel Kernels[] = {
+  { "avx512bw", Dot4Avx512 },
+  { "avx2", Dot4Avx2 },
+  { "sse", Dot4Sse }
+};
+
+// The SSE kernel is built for every CPU amun is compiled for.
+bool Supported(const Kernel& kernel) {
+  __builtin_cpu_init();
+  if(kernel.dot4 == Dot4Avx512)
+    return __builtin_cpu_supports("avx512bw");
+  if(kernel.dot4 == Dot4Avx2)
+    return __builtin_cpu_supports("avx2");
+  return true;
+}
+
+const Kernel* SelectKernel() {
+  for(const Kernel& kernel : Kernels) {
+    if(Supported(kernel))
+      return &kernel;
+  }
+  return nullptr;
+}
+
+// Set while loading, read by every product.
+std::atomic<const Kernel*> kernel(SelectKernel());
+
+}
+
+bool SetInt16Kernel(const std::string& name) {
+  if(name == "auto") {
+    kernel = SelectKernel();
+    return true;
+  }
+  for(const Kernel& k : Kernels) {
+    if(name == k.name) {
+      if(!Supported(k))
+        return false;
+      kernel = &k;
+      return true;
+    }
+  }
+  return false;
+}
+
+std::string GetInt16Kernel() {
+  return kernel.load()->name;
+}
+
+Int16Matrix::Int16Matrix()
+  : Int16Matrix(0, 0)
+{}
+
+Int16Matrix::Int16Matrix(size_t rows, size_t columns)
+  : rows_(rows), columns_(columns), stride_(RoundUp(rows, Width)),
+    multiplier_(Multiplier(rows)),
+    data_(RoundUp(columns, Group) * stride_, 0),
+    scales_(RoundUp(columns, Group), 0.0f)
+{}
+
+Int16Matrix::Int16Matrix(const Int16Matrix& m, const std::vector<size_t>& columns)
+  : Int16Matrix(m.rows_, columns.size())
+{
+  for(size_t j = 0; j < columns.size(); ++j) {
+    std::copy(m.data_.begin() + columns[j] * stride_,
+              m.data_.begin() + (columns[j] + 1) * stride_,
+              data_.begin() + j * stride_);
+    scales_[j] = m.scales_[columns[j]];
+  }
+}
+
+void Int16Matrix::QuantizeColumn(size_t j, const float* column) {
+  scales_[j] = Quantize(column, rows_, multiplier_, data_.data() + j * stride_);
+}
+
+void Prod(Matrix& Out, const Matrix& In, const Int16Matrix& W) {
+  const Dot4Kernel dot4 = kernel.load(std::memory_order_relaxed)->dot4;
+
+  assert(In.columns() == W.rows_);
+  const size_t rows = In.rows();
+  const size_t stride = W.stride_;
+
+  // Reused by the next call of the thread. Old values left in the padding
+  // of a row are harmless, they are multiplied with the zero padding of W.
+  thread_local std::vector<int16_t> in;
+  thread_local std::vector<float> inScales;
+  in.resize(std::max(in.size(), rows * stride));
+  inScales.resize(rows);
+  for(size_t i = 0; i < rows; ++i)
+    inScales[i] = Quantize(In.data(i), In.columns(), W.multiplier_, in.data() + i * stride);
+
+  // Four columns of W stay in the L1 cache while all rows of In pass by.
+  Out.resize(rows, W.columns_);
+  int32_t dots[Group];
+  for(size_t j = 0; j < W.columns_; j += Group) {
+    const int16_t* w = W.data_.data() + j * stride;
+    size_t group = std::min(Group, W.columns_ - j);
+    for(size_t i = 0; i < rows; ++i) {
+      dot4(in.data() + i * stride, w, stride, stride, dots);
+      for(size_t g = 0; g < group; ++g)
+        Out(i, j + g) = dots[g] * inScales[i] * W.scales_[j + g];
+    }
+  }
+}
+
+void Prod(Matrix& Out, const Matrix& In, const WeightMatrix& W) {
+  if(W.GetQuantized())
+    Prod(Out, In, *W.GetQuantized());
+  else
+    Out = In * W;
+}
+
+void WeightMatrix::Quantize() const {
+  if(!quantized_)
+    quantized_.reset(new Int16Matrix(*this));
+}
+
+}
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "matrix.h"
+
+namespace CPU {
+
+namespace mblas {
+
+// A weight matrix quantized to 16 bit integers for Prod. Columns are stored
+// as contiguous rows (the transpose), each with its own scale, and padded
+// to whole SIMD registers. The scales are chosen from the number of rows,
+// so that the integer dot products of Prod can never overflow.
+class Int16Matrix {
+  public:
+    Int16Matrix();
+
+    template <class MT>
+    Int16Matrix(const MT& m)
+      : Int16Matrix(m.rows(), m.columns()) {
+      Matrix transposed = blaze::trans(m);
+      for(size_t j = 0; j < columns_; ++j) {
+        QuantizeColumn(j, transposed.data(j));
+      }
+    }
+
+    // Selects some of the columns, e.g. the output layer for a filtered
+    // target vocabulary.
+    Int16Matrix(const Int16Matrix& m, const std::vector<size_t>& columns);
+
+    size_t rows() const {
+      return rows_;
+    }
+
+    size_t columns() const {
+      return columns_;
+    }
+
+  private:
+    friend void Prod(Matrix&, const Matrix&, const Int16Matrix&);
+
+    Int16Matrix(size_t rows, size_t columns);
+
+    void QuantizeColumn(size_t j, const float* column);
+
+    size_t rows_;
+    size_t columns_;
+    size_t stride_;
+    float multiplier_;
+
+    std::vector<int16_t> data_;
+    std::vector<float> scales_;
+};
+
+// Out = In * W. The rows of In are quantized on the fly, the products are
+// computed with the widest integer SIMD instructions the CPU supports.
+void Prod(Matrix& Out, const Matrix& In, const Int16Matrix& W);
+
+// Forces the kernel of Prod: "sse", "avx2", "avx512bw", or "auto" for the
+// widest one the CPU supports. All of them compute the same exact integer
+// sums. Returns false for unknown kernels or ones the CPU cannot run.
+bool SetInt16Kernel(const std::string& name);
+
+// The name of the kernel Prod uses.
+std::string GetInt16Kernel();
+
+// Uses the int16 copy of W if it has been quantized, blaze otherwise.
+void Prod(Matrix& Out, const Matrix& In, const WeightMatrix& W);
+
+}
+}
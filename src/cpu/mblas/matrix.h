@@ -2,6 +2,7 @@
 
 #include <cmath>
 #include <iostream>
+#include <memory>
 #include <vector>
 #include <sstream>
 
@@ -136,6 +137,91 @@ class ArrayMatrix : public BlazeMatrix<float, blaze::rowMajor>
 
 };
 
+class Int16Matrix;
+
+////////////////////////////////////////////////////////////////////////
+// Read-only model matrix. It either owns an aligned copy of its elements or
+// views memory that is owned elsewhere, e.g. a memory-mapped binary model.
+// Rows are aligned like those of Matrix, but blaze is told they are not
+// padded: it would store zeros into the padding of a view, which faults on
+// a read-only mapping and unshares the pages of a private one.
+class WeightMatrix : public blaze::CustomMatrix<float, blaze::aligned,
+                                                blaze::unpadded,
+                                                blaze::rowMajor> {
+  public:
+    typedef blaze::CustomMatrix<float, blaze::aligned,
+                                blaze::unpadded,
+                                blaze::rowMajor> BlazeBase;
+
+    WeightMatrix() {}
+
+    // Views rows x columns floats at data, spacing floats apart, without
+    // copying or writing, see CanView.
+    WeightMatrix(float* data, size_t rows, size_t columns, size_t spacing)
+      : BlazeBase(data, rows, columns, spacing)
+    {}
+
+    WeightMatrix(size_t rows, size_t columns, float val = 0)
+      : data_(rows, columns, val) {
+      View();
+    }
+
+    template <class MT>
+    WeightMatrix(const MT& rhs)
+      : data_(rhs) {
+      View();
+    }
+
+    WeightMatrix(mblas::Matrix&& rhs)
+      : data_(std::move(rhs)) {
+      View();
+    }
+
+    // Copies of a view share the memory, copies of an owner own a copy.
+    WeightMatrix(const WeightMatrix& rhs)
+      : BlazeBase(rhs), data_(rhs.data_), quantized_(rhs.quantized_) {
+      View();
+    }
+
+    WeightMatrix(WeightMatrix&& rhs)
+      : BlazeBase(rhs), data_(std::move(rhs.data_)),
+        quantized_(std::move(rhs.quantized_)) {
+      View();
+    }
+
+    WeightMatrix& operator=(const WeightMatrix&) = delete;
+
+    static bool CanView(const float* data, size_t columns, size_t spacing) {
+      return spacing >= columns
+        && spacing % blaze::SIMDTrait<float>::size == 0
+        && blaze::checkAlignment(data);
+    }
+
+    // The smallest row spacing of a view with columns columns.
+    static size_t Spacing(size_t columns) {
+      size_t simd = blaze::SIMDTrait<float>::size;
+      return (columns + simd - 1) / simd * simd;
+    }
+
+    // Adds an int16 copy that Prod uses instead of the floats, see int16.h.
+    // Like the float elements it is shared by all threads.
+    void Quantize() const;
+
+    const Int16Matrix* GetQuantized() const {
+      return quantized_.get();
+    }
+
+  private:
+    void View() {
+      if(data_.rows() * data_.columns() > 0) {
+        BlazeBase::reset(data_.data(), data_.rows(), data_.columns(), data_.spacing());
+      }
+    }
+
+    mblas::Matrix data_;
+    mutable std::shared_ptr<const Int16Matrix> quantized_;
+};
+
 ////////////////////////////////////////////////////////////////////////
 template <class M>
 std::string Debug(const M& m)
@@ -0,0 +1,30 @@
+#include <iostream>
+#include <string>
+
+#include "cpu/npz_converter.h"
+#include "cpu/binary_model.h"
+#include "cpu/dl4mt/model.h"
+
+// Converts a Nematus/DL4MT npz model into amun's memory-mappable binary
+// format, see BinaryModel. The result is used like the npz file, as the
+// path of a scorer.
+int main(int argc, char* argv[]) {
+  if(argc != 3) {
+    std::cerr << "Usage: " << argv[0] << " model.npz model.bin" << std::endl;
+    return 1;
+  }
+
+  try {
+    CPU::NpzConverter npz(argv[1]);
+    CPU::BinaryModelWriter writer(npz);
+    CPU::Weights weights(writer);
+    weights.TransposeOutputLayer(writer);
+    writer.Save(argv[2]);
+  }
+  catch(std::exception& e) {
+    std::cerr << "Error: " << e.what() << std::endl;
+    return 1;
+  }
+
+  return 0;
+}
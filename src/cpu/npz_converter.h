@@ -83,6 +83,14 @@ class NpzConverter {
       }
       return blaze::trans(matrix);
     }
+
+    // Two matrices side by side, e.g. the gates and the candidate
+    // activation of a GRU, so both are computed by one product.
+    mblas::Matrix Concat(const std::string& key1,
+                         const std::string& key2) const {
+      using namespace mblas;
+      return mblas::Concat<byColumn, Matrix>((*this)[key1], (*this)[key2]);
+    }
   
   private:
     cnpy::npz_t model_;
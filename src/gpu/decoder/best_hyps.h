@@ -48,30 +48,43 @@ class BestHyps {
       // std::cerr << std::endl;
     }
 
-    std::vector<SoftAlignmentPtr> GetAlignments(const std::vector<ScorerPtr>& scorers,
-                                                size_t hypIndex) {
-      std::vector<SoftAlignmentPtr> alignments;
-      for (auto& scorer : scorers) {
-        if (GPU::EncoderDecoder* encdec = dynamic_cast<GPU::EncoderDecoder*>(scorer.get())) {
+    void SetAlignments(HypothesisArena& arena, const Hypothesis& hyp,
+                       const std::vector<ScorerPtr>& scorers, size_t hypIndex) {
+      for (size_t j = 0; j < scorers.size(); ++j) {
+        if (GPU::EncoderDecoder* encdec = dynamic_cast<GPU::EncoderDecoder*>(scorers[j].get())) {
           auto& attention = encdec->GetAttention();
           size_t attLength = attention.Cols();
 
-          alignments.emplace_back(new SoftAlignment(
-                attention.begin() + hypIndex * attLength,
-                attention.begin() + (hypIndex + 1) * attLength));
+          arena.SetAlignmentSize(scorers.size(), attLength);
+          thrust::copy(attention.begin() + hypIndex * attLength,
+                       attention.begin() + (hypIndex + 1) * attLength,
+                       arena.GetAlignment(hyp, j));
         } else {
           UTIL_THROW2("Return Alignment is allowed only with Nematus scorer.");
         }
       }
-      return alignments;
     }
 
-    void operator()(Beam& bestHyps,
+    void operator()(Beams& bestHyps,
+          const Beams& prevHyps,
+          const std::vector<size_t>& beamSizes,
+          const std::vector<ScorerPtr>& scorers,
+          const Words& filterIndices,
+          bool returnAlignment,
+          const std::vector<HypothesisArena*>& arenas) {
+      UTIL_THROW_IF2(prevHyps.size() != 1,
+                     "Batched decoding is not supported on GPU");
+      CalcBeam(bestHyps[0], prevHyps[0], beamSizes[0], scorers,
+               filterIndices, returnAlignment, *arenas[0]);
+    }
+
+    void CalcBeam(Beam& bestHyps,
           const Beam& prevHyps,
           const size_t beamSize,
           const std::vector<ScorerPtr>& scorers,
           const Words& filterIndices,
-          bool returnAlignment) {
+          bool returnAlignment,
+          HypothesisArena& arena) {
       using namespace mblas;
 
       mblas::Matrix& Probs = static_cast<mblas::Matrix&>(scorers[0]->GetProbs());
@@ -123,33 +136,27 @@ class BestHyps {
         size_t hypIndex  = bestKeys[i] / Probs.Cols();
         float cost = bestCosts[i];
 
-        HypothesisPtr hyp;
+        HypothesisPtr hyp = arena.New(prevHyps[hypIndex], wordIndex, hypIndex, cost);
         if (returnAlignment) {
-          hyp.reset(new Hypothesis(prevHyps[hypIndex], wordIndex, hypIndex, cost,
-                                   GetAlignments(scorers, hypIndex)));
-        } else {
-          hyp.reset(new Hypothesis(prevHyps[hypIndex], wordIndex, hypIndex, cost));
+          SetAlignments(arena, *hyp, scorers, hypIndex);
         }
 
         if(doBreakdown) {
-          hyp->GetCostBreakdown().resize(scorers.size());
+          arena.SetBreakdownSize(scorers.size());
+          float* breakdown = arena.GetCostBreakdown(*hyp);
+          const float* prevBreakdown = arena.GetCostBreakdown(*prevHyps[hypIndex]);
           float sum = 0;
           for (size_t j = 0; j < scorers.size(); ++j) {
             if (j == 0)
-              hyp->GetCostBreakdown()[0] = breakDowns[0][i];
+              breakdown[0] = breakDowns[0][i];
             else {
-              float cost = 0;
-              if (j < scorers.size()) {
-                  if (prevHyps[hypIndex]->GetCostBreakdown().size() < scorers.size())
-                    const_cast<HypothesisPtr&>(prevHyps[hypIndex])->GetCostBreakdown().resize(scorers.size(), 0.0f);
-                  cost = breakDowns[j][i] + const_cast<HypothesisPtr&>(prevHyps[hypIndex])->GetCostBreakdown()[j];
-              }
+              float cost = breakDowns[j][i] + prevBreakdown[j];
               sum += weights_[scorers[j]->GetName()] * cost;
-              hyp->GetCostBreakdown()[j] = cost;
+              breakdown[j] = cost;
             }
           }
-          hyp->GetCostBreakdown()[0] -= sum;
-          hyp->GetCostBreakdown()[0] /= weights_[scorers[0]->GetName()];
+          breakdown[0] -= sum;
+          breakdown[0] /= weights_[scorers[0]->GetName()];
         }
       bestHyps.push_back(hyp);
       }
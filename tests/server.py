@@ -0,0 +1,138 @@
+#!/usr/bin/env python
+# -*- coding: utf-8 -*-
+"""
+Tests amun --server on a Unix socket.
+
+    server.py REFERENCE INPUT AMUN [ARGS...]
+
+Several clients send the lines of INPUT at the same time; every reply must
+match REFERENCE, the output of a normal run. Then the server must exit
+after SIGTERM. A second server is stopped with two signals while clients
+are still waiting: each of them must get a prefix of its translations,
+possibly followed by an ERROR line, and then the end of the connection.
+"""
+
+from __future__ import print_function
+
+import os
+import signal
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+SOCKET = 'test100.sock'
+CLIENTS = 4
+TIMEOUT = 300
+
+
+def start(command, log):
+    if os.path.exists(SOCKET):
+        os.unlink(SOCKET)
+    server = subprocess.Popen(command + ['--server', '--socket', SOCKET],
+                              stderr=open(log, 'w'))
+    deadline = time.time() + TIMEOUT
+    while not os.path.exists(SOCKET):
+        if server.poll() is not None or time.time() > deadline:
+            sys.exit('The server did not start, see ' + log)
+        time.sleep(0.1)
+    return server
+
+
+def stop(server, signals):
+    for i, number in enumerate(signals):
+        if i > 0:
+            time.sleep(0.2)
+        server.send_signal(number)
+    deadline = time.time() + TIMEOUT
+    while server.poll() is None:
+        if time.time() > deadline:
+            server.kill()
+            sys.exit('The server did not exit after the signals')
+        time.sleep(0.1)
+    if server.returncode != 0:
+        sys.exit('The server exited with %d' % server.returncode)
+
+
+class Client(threading.Thread):
+
+    def __init__(self, lines, replied):
+        threading.Thread.__init__(self)
+        self.lines = lines
+        self.replied = replied
+        self.reply = []
+        self.error = None
+
+    def run(self):
+        try:
+            connection = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+            connection.settimeout(TIMEOUT)
+            connection.connect(SOCKET)
+            connection.sendall(b''.join(self.lines))
+            connection.shutdown(socket.SHUT_WR)
+            data = b''
+            while True:
+                chunk = connection.recv(65536)
+                if not chunk:
+                    break
+                data += chunk
+                self.replied.set()
+            connection.close()
+            self.reply = data.splitlines(True)
+        except Exception as e:
+            self.error = e
+
+
+def connect(slices):
+    replied = threading.Event()
+    clients = [Client(lines, replied) for lines in slices]
+    for client in clients:
+        client.start()
+    return clients, replied
+
+
+def join(clients):
+    for client in clients:
+        client.join()
+        if client.error is not None:
+            sys.exit('Client failed: %s' % client.error)
+
+
+def main():
+    reference = open(sys.argv[1], 'rb').readlines()
+    lines = open(sys.argv[2], 'rb').readlines()
+    command = sys.argv[3:]
+
+    # concurrent clients, each with every CLIENTS-th line
+    server = start(command, 'test100.server.log')
+    clients, _ = connect([lines[i::CLIENTS] for i in range(CLIENTS)])
+    join(clients)
+    for i, client in enumerate(clients):
+        if client.reply != reference[i::CLIENTS]:
+            sys.exit('Client %d got other translations than a normal run' % i)
+    stop(server, [signal.SIGTERM])
+    print('%d concurrent clients got the translations of a normal run' % CLIENTS)
+
+    # shut down with lines still queued
+    server = start(command + ['--cpu-threads', '1'], 'test100.server.shutdown.log')
+    clients, replied = connect([lines] * CLIENTS)
+    if not replied.wait(TIMEOUT):
+        sys.exit('No client got a reply')
+    stop(server, [signal.SIGTERM, signal.SIGINT])
+    join(clients)
+    errors = 0
+    for i, client in enumerate(clients):
+        translations = client.reply
+        if translations and translations[-1].startswith(b'ERROR: '):
+            translations = translations[:-1]
+            errors += 1
+        if translations != reference[:len(translations)]:
+            sys.exit('Client %d got wrong translations during shutdown' % i)
+    if errors == 0:
+        sys.exit('No client got an error line for its queued lines')
+    print('%d of %d clients got an error line for their queued lines' % (errors, CLIENTS))
+
+
+if __name__ == '__main__':
+    main()